@@ -6,8 +6,12 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
-#include <learnopengl/shader.h>
+#include <rg/GeometryArena.h>
+#include <rg/VertexPacking.h>
 
+#include <algorithm>
+#include <cmath>
+#include <cstring>
 #include <string>
 #include <vector>
 using namespace std;
@@ -25,12 +29,70 @@ struct Vertex {
     glm::vec3 Bitangent;
 };
 
+// GPU side vertex of rg::VertexFormat::Packed
+struct PackedVertex {
+    // unorm16 inside the mesh's bounding box, w unused
+    uint16_t Position[4];
+    // octahedral, snorm16
+    int16_t Normal[2];
+    // half floats
+    uint16_t TexCoords[2];
+    // octahedral tangent (xy) and the sign of the bitangent (z), snorm16
+    int16_t Tangent[4];
+};
+
+// GPU side vertex of rg::VertexFormat::PackedFloatPosition
+struct PackedVertexFloatPosition {
+    float Position[3];
+    int16_t Normal[2];
+    uint16_t TexCoords[2];
+    int16_t Tangent[4];
+};
+
+static_assert(sizeof(PackedVertex) == 24, "PackedVertex must stay tightly packed");
+static_assert(sizeof(PackedVertexFloatPosition) == 28, "PackedVertexFloatPosition must stay tightly packed");
 
 
 struct Texture {
+    // the GL_TEXTURE_2D_ARRAY holding the image
     unsigned int id;
     string type;
     string path;
+    // index of that array in the model's rg::TextureArraySet (-1 if the image is missing) and the layer in it
+    int array = -1;
+    int layer = 0;
+    // what the shader reads instead where there is no array: the color of a single color image, zero otherwise
+    glm::vec4 color = glm::vec4(0.0f);
+    // not loaded, the model's shader samples no map of this type (Model::LoadTextures loads it later)
+    bool deferred = false;
+    // id, array and layer are final; until then id is the loader slot
+    bool resolved = false;
+};
+
+// one placed copy of a mesh, drawn as an instance
+struct MeshInstance {
+    // from the mesh's local space into model space
+    glm::mat4 transform;
+    // set of Mesh::instanceTexCoords the copy samples with, -1 for the texture coordinates of the vertices
+    int texCoordSet;
+};
+
+// run of the arena's index buffer drawn by one call; firstIndex counts indices of the mesh's index type from
+// the start of the buffer, the stored indices are relative to baseVertex
+struct IndexRange {
+    unsigned int firstIndex;
+    unsigned int count;
+    int baseVertex;
+};
+
+// one of the meshes merged into a static batch, culled on its own: its run of Mesh::indices and its bounds in the
+// space of the batch
+struct SubMesh {
+    unsigned int firstIndex;
+    unsigned int indexCount;
+    glm::vec3 aabbMin;
+    glm::vec3 aabbMax;
+    float boundingRadius;
 };
 
 class Mesh {
@@ -39,84 +101,178 @@ public:
     vector<Vertex>       vertices;
     vector<unsigned int> indices;
     vector<Texture>      textures;
+    // object space bounding box
+    glm::vec3 aabbMin;
+    glm::vec3 aabbMax;
+    // radius of the bounding sphere around the center of the box
+    float boundingRadius;
+    // every copy of the mesh, drawn instanced; a single untransformed instance unless the import found the
+    // same geometry more than once (the vertices are then in the mesh's local space)
+    vector<MeshInstance> instances;
+    // texture coordinate sets of copies with their own UV layout, vertices.size() entries per set
+    vector<glm::vec2> instanceTexCoords;
+    // the meshes rg::BatchStaticMeshes merged into this one, in index order; empty for meshes that are no batch
+    vector<SubMesh> subMeshes;
 
+    // VAO of the geometry arena of vertexFormat, shared with every other mesh of that format
     unsigned int VAO;
-    std::string glslIdentifierPrefix;
+    // where the vertices and indices live inside the arena
+    rg::GeometryAllocation allocation;
+    // GL_UNSIGNED_SHORT whenever the vertices (of each range) fit, GL_UNSIGNED_INT otherwise
+    GLenum indexType;
+    vector<IndexRange> indexRanges;
+    // layout of the vertex buffer; vertices above always keep the full data
+    rg::VertexFormat vertexFormat;
+    // object space position = positionOffset + stored position * positionScale
+    glm::vec3 positionOffset;
+    glm::vec3 positionScale;
     // constructor
-    Mesh(vector<Vertex> vertices, vector<unsigned int> indices, vector<Texture> textures)
+    Mesh(vector<Vertex> vertices, vector<unsigned int> indices, vector<Texture> textures,
+         rg::VertexFormat vertexFormat = rg::VertexFormat::Full)
     {
         this->vertices = vertices;
         this->indices = indices;
         this->textures = textures;
+        this->vertexFormat = vertexFormat;
+        this->instances.assign(1, MeshInstance{glm::mat4(1.0f), -1});
+        computeBounds();
 
         // now that we have all the required data, set the vertex buffers and its attribute pointers.
         setupMesh();
     }
+    // constructor used when the bounds are already known (e.g. read from the mesh cache)
+    Mesh(vector<Vertex> vertices, vector<unsigned int> indices, vector<Texture> textures, glm::vec3 aabbMin, glm::vec3 aabbMax,
+         rg::VertexFormat vertexFormat = rg::VertexFormat::Full)
+    {
+        this->vertices = std::move(vertices);
+        this->indices = std::move(indices);
+        this->textures = std::move(textures);
+        this->vertexFormat = vertexFormat;
+        this->instances.assign(1, MeshInstance{glm::mat4(1.0f), -1});
+        this->aabbMin = aabbMin;
+        this->aabbMax = aabbMax;
+        computeBoundingRadius();
+
+        setupMesh();
+    }
 
-    // render the mesh
-    void Draw(Shader &shader)
-    {
-        // bind appropriate textures
-        unsigned int diffuseNr  = 1;
-        unsigned int specularNr = 1;
-        unsigned int normalNr   = 1;
-        unsigned int heightNr   = 1;
-        for(unsigned int i = 0; i < textures.size(); i++)
-        {
-            glActiveTexture(GL_TEXTURE0 + i); // active proper texture unit before binding
-            // retrieve texture number (the N in diffuse_textureN)
-            string number;
-            string name = textures[i].type;
-            if(name == "texture_diffuse")
-                number = std::to_string(diffuseNr++);
-            else if(name == "texture_specular")
-                number = std::to_string(specularNr++); // transfer unsigned int to stream
-            else if(name == "texture_normal")
-                number = std::to_string(normalNr++); // transfer unsigned int to stream
-            else if(name == "texture_height")
-                number = std::to_string(heightNr++); // transfer unsigned int to stream
-
-            // now set the sampler to the correct texture unit
-            glUniform1i(glGetUniformLocation(shader.ID, (glslIdentifierPrefix + name + number).c_str()), i);
-            // and finally bind the texture
-            glBindTexture(GL_TEXTURE_2D, textures[i].id);
+    // shared vertex/index buffers of one vertex format, created on first use
+    static rg::GeometryArena& Arena(rg::VertexFormat format)
+    {
+        static rg::GeometryArena full(sizeof(Vertex), setupFullAttributes);
+        static rg::GeometryArena packed(sizeof(PackedVertex), [] {
+            setupPackedAttributes<PackedVertex>(GL_UNSIGNED_SHORT, 4, GL_TRUE);
+        });
+        static rg::GeometryArena packedFloatPosition(sizeof(PackedVertexFloatPosition), [] {
+            setupPackedAttributes<PackedVertexFloatPosition>(GL_FLOAT, 3, GL_FALSE);
+        });
+        switch (format) {
+            case rg::VertexFormat::Packed: return packed;
+            case rg::VertexFormat::PackedFloatPosition: return packedFloatPosition;
+            default: return full;
         }
+    }
 
+    // bytes of the vertex buffer on the GPU
+    size_t VertexBufferSize() const
+    {
+        return vertices.size() * vertexStride();
+    }
 
+    // bytes of the index buffer on the GPU
+    size_t IndexBufferSize() const
+    {
+        return indices.size() * (indexType == GL_UNSIGNED_SHORT ? sizeof(uint16_t) : sizeof(unsigned int));
+    }
 
-        // draw mesh
-        glBindVertexArray(VAO);
-        glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
-        glBindVertexArray(0);
+private:
+    void computeBounds()
+    {
+        aabbMin = glm::vec3(0.0f);
+        aabbMax = glm::vec3(0.0f);
+        boundingRadius = 0.0f;
+        if (vertices.empty())
+            return;
+        aabbMin = aabbMax = vertices[0].Position;
+        for (const Vertex& vertex : vertices) {
+            aabbMin = glm::min(aabbMin, vertex.Position);
+            aabbMax = glm::max(aabbMax, vertex.Position);
+        }
+        computeBoundingRadius();
+    }
 
-        // always good practice to set everything back to defaults once configured.
-        glActiveTexture(GL_TEXTURE0);
+    // tighter than the half diagonal of the box for most shapes
+    void computeBoundingRadius()
+    {
+        glm::vec3 center = (aabbMin + aabbMax) * 0.5f;
+        float radius2 = 0.0f;
+        for (const Vertex& vertex : vertices) {
+            glm::vec3 d = vertex.Position - center;
+            radius2 = std::max(radius2, glm::dot(d, d));
+        }
+        boundingRadius = std::sqrt(radius2);
     }
 
-private:
-    // render data
-    unsigned int VBO, EBO;
+    size_t vertexStride() const
+    {
+        switch (vertexFormat) {
+            case rg::VertexFormat::Packed: return sizeof(PackedVertex);
+            case rg::VertexFormat::PackedFloatPosition: return sizeof(PackedVertexFloatPosition);
+            default: return sizeof(Vertex);
+        }
+    }
 
-    // initializes all the buffer objects/arrays
-    void setupMesh()
+    // fills the shared fields of both packed layouts
+    template<typename V>
+    static void packAttributes(const Vertex& vertex, V& packed)
+    {
+        glm::vec2 normal = rg::OctEncode(vertex.Normal);
+        glm::vec2 tangent = rg::OctEncode(vertex.Tangent);
+        // the bitangent is rebuilt as sign * cross(normal, tangent)
+        float handedness = glm::dot(glm::cross(vertex.Normal, vertex.Tangent), vertex.Bitangent) < 0.0f ? -1.0f : 1.0f;
+        packed.Normal[0] = rg::ToSnorm16(normal.x);
+        packed.Normal[1] = rg::ToSnorm16(normal.y);
+        packed.TexCoords[0] = rg::FloatToHalf(vertex.TexCoords.x);
+        packed.TexCoords[1] = rg::FloatToHalf(vertex.TexCoords.y);
+        packed.Tangent[0] = rg::ToSnorm16(tangent.x);
+        packed.Tangent[1] = rg::ToSnorm16(tangent.y);
+        packed.Tangent[2] = rg::ToSnorm16(handedness);
+        packed.Tangent[3] = 0;
+    }
+
+    // the vertices in the packed layout V
+    template<typename V>
+    vector<unsigned char> packVertices() const
     {
-        // create buffers/arrays
-        glGenVertexArrays(1, &VAO);
-        glGenBuffers(1, &VBO);
-        glGenBuffers(1, &EBO);
+        glm::vec3 extent = aabbMax - aabbMin;
+        vector<unsigned char> bytes(vertices.size() * sizeof(V));
+        V* packed = reinterpret_cast<V*>(bytes.data());
+        for (size_t i = 0; i < vertices.size(); i++) {
+            packAttributes(vertices[i], packed[i]);
+            storePosition(vertices[i].Position, extent, packed[i]);
+        }
+        return bytes;
+    }
 
-        glBindVertexArray(VAO);
-        // load data into vertex buffers
-        glBindBuffer(GL_ARRAY_BUFFER, VBO);
+    // attribute pointers of the packed layout V into the bound GL_ARRAY_BUFFER
+    template<typename V>
+    static void setupPackedAttributes(GLenum positionType, GLint positionSize, GLboolean positionNormalized)
+    {
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, positionSize, positionType, positionNormalized, sizeof(V), (void*)offsetof(V, Position));
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 2, GL_SHORT, GL_TRUE, sizeof(V), (void*)offsetof(V, Normal));
+        glEnableVertexAttribArray(2);
+        glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, sizeof(V), (void*)offsetof(V, TexCoords));
+        glEnableVertexAttribArray(3);
+        glVertexAttribPointer(3, 4, GL_SHORT, GL_TRUE, sizeof(V), (void*)offsetof(V, Tangent));
+    }
+
+    static void setupFullAttributes()
+    {
         // A great thing about structs is that their memory layout is sequential for all its items.
         // The effect is that we can simply pass a pointer to the struct and it translates perfectly to a glm::vec3/2 array which
         // again translates to 3/2 floats which translates to a byte array.
-        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), &vertices[0], GL_STATIC_DRAW);
-
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
-
-        // set the vertex attribute pointers
         // vertex Positions
         glEnableVertexAttribArray(0);
         glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
@@ -132,8 +288,103 @@ private:
         // vertex bitangent
         glEnableVertexAttribArray(4);
         glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Bitangent));
+    }
+
+    void storePosition(glm::vec3 position, glm::vec3 extent, PackedVertex& packed) const
+    {
+        for (int axis = 0; axis < 3; axis++)
+            packed.Position[axis] = rg::ToUnorm16(extent[axis] > 0.0f ? (position[axis] - aabbMin[axis]) / extent[axis] : 0.0f);
+        packed.Position[3] = 0;
+    }
 
-        glBindVertexArray(0);
+    void storePosition(glm::vec3 position, glm::vec3 extent, PackedVertexFloatPosition& packed) const
+    {
+        packed.Position[0] = position.x;
+        packed.Position[1] = position.y;
+        packed.Position[2] = position.z;
+    }
+
+    // Picks 16-bit indices when possible and returns the index buffer contents. Meshes with more vertices than a 16-bit index can address are
+    // split into ranges of consecutive triangles whose vertices span less than 65536, each drawn relative
+    // to its lowest vertex (the import orders vertices by first use, so ranges stay long).
+    vector<unsigned char> buildIndices()
+    {
+        const unsigned int SHORT_INDEX_SPAN = 65536;
+        indexRanges.clear();
+        indexType = GL_UNSIGNED_SHORT;
+        if (vertices.size() <= SHORT_INDEX_SPAN) {
+            indexRanges.push_back(IndexRange{0, (unsigned int)indices.size(), 0});
+        } else {
+            unsigned int rangeMin = 0, rangeMax = 0, first = 0;
+            for (unsigned int i = 0; i + 2 < indices.size(); i += 3) {
+                unsigned int triangleMin = std::min(indices[i], std::min(indices[i + 1], indices[i + 2]));
+                unsigned int triangleMax = std::max(indices[i], std::max(indices[i + 1], indices[i + 2]));
+                if (triangleMax - triangleMin >= SHORT_INDEX_SPAN) {
+                    // a single triangle spans too far, only 32-bit indices can draw it
+                    indexType = GL_UNSIGNED_INT;
+                    break;
+                }
+                if (i == first) {
+                    rangeMin = triangleMin;
+                    rangeMax = triangleMax;
+                } else if (std::max(rangeMax, triangleMax) - std::min(rangeMin, triangleMin) >= SHORT_INDEX_SPAN) {
+                    indexRanges.push_back(IndexRange{first, i - first, (int)rangeMin});
+                    first = i;
+                    rangeMin = triangleMin;
+                    rangeMax = triangleMax;
+                } else {
+                    rangeMin = std::min(rangeMin, triangleMin);
+                    rangeMax = std::max(rangeMax, triangleMax);
+                }
+            }
+            if (indexType == GL_UNSIGNED_SHORT && first < indices.size())
+                indexRanges.push_back(IndexRange{first, (unsigned int)indices.size() - first, (int)rangeMin});
+        }
+
+        if (indexType == GL_UNSIGNED_INT) {
+            indexRanges.assign(1, IndexRange{0, (unsigned int)indices.size(), 0});
+            vector<unsigned char> bytes(indices.size() * sizeof(unsigned int));
+            std::memcpy(bytes.data(), indices.data(), bytes.size());
+            return bytes;
+        }
+        vector<unsigned char> bytes(indices.size() * sizeof(uint16_t));
+        uint16_t* shortIndices = reinterpret_cast<uint16_t*>(bytes.data());
+        for (const IndexRange& range : indexRanges)
+            for (unsigned int i = range.firstIndex; i < range.firstIndex + range.count; i++)
+                shortIndices[i] = (uint16_t)(indices[i] - range.baseVertex);
+        return bytes;
+    }
+
+    // copies the vertices and indices into the arena of vertexFormat
+    void setupMesh()
+    {
+        positionOffset = glm::vec3(0.0f);
+        positionScale = glm::vec3(1.0f);
+        if (vertexFormat == rg::VertexFormat::Packed) {
+            positionOffset = aabbMin;
+            positionScale = aabbMax - aabbMin;
+        }
+
+        vector<unsigned char> indexBytes = buildIndices();
+        vector<unsigned char> vertexBytes;
+        if (vertexFormat == rg::VertexFormat::Packed)
+            vertexBytes = packVertices<PackedVertex>();
+        else if (vertexFormat == rg::VertexFormat::PackedFloatPosition)
+            vertexBytes = packVertices<PackedVertexFloatPosition>();
+        else {
+            vertexBytes.resize(vertices.size() * sizeof(Vertex));
+            std::memcpy(vertexBytes.data(), vertices.data(), vertexBytes.size());
+        }
+
+        rg::GeometryArena& arena = Arena(vertexFormat);
+        allocation = arena.Allocate(vertexBytes.data(), vertices.size(), indexBytes.data(), indexBytes.size());
+        VAO = arena.VAO();
+        // make the ranges absolute inside the shared buffers
+        size_t indexSize = indexType == GL_UNSIGNED_SHORT ? sizeof(uint16_t) : sizeof(unsigned int);
+        for (IndexRange& range : indexRanges) {
+            range.firstIndex += (unsigned int)(allocation.indexOffset / indexSize);
+            range.baseVertex += (int)allocation.firstVertex;
+        }
     }
 };
 #endif
\ No newline at end of file
@@ -12,12 +12,23 @@
 
 #include <learnopengl/mesh.h>
 #include <learnopengl/shader.h>
+#include <rg/Frustum.h>
+#include <rg/IndirectDraw.h>
+#include <rg/MeshCache.h>
+#include <rg/MeshInstancing.h>
+#include <rg/MeshOptimizer.h>
+#include <rg/ShaderReflection.h>
+#include <rg/StaticBatching.h>
+#include <rg/TextureLoader.h>
+#include <rg/ThreadPool.h>
+#include <rg/VertexWelder.h>
 
 #include <string>
 #include <fstream>
 #include <sstream>
 #include <iostream>
 #include <map>
+#include <unordered_map>
 #include <vector>
 using namespace std;
 
@@ -33,75 +44,372 @@ public:
     vector<Mesh>    meshes;
     string directory;
     bool gammaCorrection;
-
-    // constructor, expects a filepath to a 3D model.
-    Model(string const &path, bool gamma = false) : gammaCorrection(gamma)
+    // vertex buffer layout of every mesh of this model
+    rg::VertexFormat vertexFormat;
+    // how long decoding and uploading this model's textures took
+    rg::TextureLoadStats textureStats;
+    // meshes and draws before and after static batching, equal when it is off
+    rg::StaticBatchStats batchStats;
+
+    // constructor, expects a filepath to a 3D model. gamma stores the diffuse maps in sRGB formats so the shader
+    // reads linear colors; compressTextures block compresses the textures on load (cached next to each image),
+    // call rg::DetectS3tc first. staticBatching merges the meshes sharing a material into one draw after loading.
+    // Only the map types textureUsage names are loaded, pass rg::TextureUsage::FromProgram of the model's shader.
+    Model(string const &path, bool gamma = false, rg::VertexFormat vertexFormat = rg::VertexFormat::Full,
+          bool compressTextures = false, bool staticBatching = false,
+          const rg::TextureUsage &textureUsage = rg::TextureUsage::All())
+            : gammaCorrection(gamma), vertexFormat(vertexFormat), textureUsage(textureUsage),
+              staticBatching(staticBatching)
     {
+        textureLoader.SetCompression(compressTextures);
+        textureLoader.SetSrgbDecode(gammaCorrection);
+        textureLoader.SetReduction(true);
         loadModel(path);
+        printMemoryReport(path);
+        printDeferredTextures();
     }
 
-    // draws the model, and thus all its meshes
-    void Draw(Shader &shader)
+    // loads the maps skipped so far that usage samples, for a shader variant needing more than the model's
+    // shader; rebuilds the material buffer if anything was loaded. Must run on the GL thread, binds through GL
+    // directly and so invalidates rg::GLCache().
+    void LoadTextures(const rg::TextureUsage &usage)
     {
-        for(unsigned int i = 0; i < meshes.size(); i++)
-            meshes[i].Draw(shader);
+        textureUsage.Add(usage);
+        bool requested = false;
+        for (Texture& texture : textures_loaded)
+            if (texture.deferred && textureUsage.Uses(texture.type))
+            {
+                texture.id = textureLoader.Request(directory + '/' + texture.path, texture.type == "texture_diffuse");
+                texture.deferred = false;
+                requested = true;
+            }
+        if (!requested)
+            return;
+        // the meshes hold copies of textures_loaded
+        for (Mesh& mesh : meshes)
+            for (Texture& texture : mesh.textures)
+                if (texture.deferred && textureUsage.Uses(texture.type))
+                    for (const Texture& loaded : textures_loaded)
+                        if (loaded.path == texture.path)
+                            texture = loaded;
+        finishTextures();
+        drawList.Build(meshes);
+        rg::GLCache().Invalidate();
     }
 
-    void SetShaderTextureNamePrefix(std::string prefix) {
-        for (Mesh& mesh: meshes) {
-            mesh.glslIdentifierPrefix = prefix;
-        }
+    // VAO of the geometry arena all meshes live in
+    unsigned int VAO() const
+    {
+        return Mesh::Arena(vertexFormat).VAO();
+    }
+
+    // binds the texture arrays every mesh samples from
+    void BindTextures() const
+    {
+        textureArrays.Bind();
+    }
+
+    // draws the model, and thus all its meshes, with VAO() and the textures bound; multiDraw submits them
+    // with glMultiDrawElementsIndirect where the context supports it
+    rg::IndirectDrawStats Draw(bool multiDraw = true)
+    {
+        return drawMeshes(nullptr, multiDraw);
+    }
+
+    // draws only the objects whose bounds intersect the frustum; build the frustum from
+    // projection * view * model so it is in the object space of this model
+    rg::IndirectDrawStats Draw(const rg::Frustum &frustum, rg::CullStats &stats, bool multiDraw = true)
+    {
+        unsigned int visibleCount = bounds.Cull(frustum, visibleObjects);
+        stats.drawn += visibleCount;
+        stats.culled += ObjectCount() - visibleCount;
+        return drawMeshes(&visibleObjects, multiDraw);
+    }
+
+    // what culling tests one by one: every mesh instance, or every mesh merged into a static batch
+    unsigned int ObjectCount() const
+    {
+        return (unsigned int)drawList.ObjectCount();
+    }
+
+    // copies of all meshes placed in the model, each drawn as one instance
+    unsigned int InstanceCount() const
+    {
+        return (unsigned int)drawList.InstanceCount();
+    }
+
+    // object space bounds of the whole model, every instance included
+    void Bounds(glm::vec3 &aabbMin, glm::vec3 &aabbMax) const
+    {
+        bool first = true;
+        aabbMin = aabbMax = glm::vec3(0.0f);
+        for (const Mesh& mesh : meshes)
+            for (const MeshInstance& instance : mesh.instances)
+            {
+                glm::vec3 instanceMin, instanceMax;
+                float radius;
+                instanceBounds(mesh, instance.transform, instanceMin, instanceMax, radius);
+                aabbMin = first ? instanceMin : glm::min(aabbMin, instanceMin);
+                aabbMax = first ? instanceMax : glm::max(aabbMax, instanceMax);
+                first = false;
+            }
     }
+
+    // bytes of all vertex buffers on the GPU, texture coordinates of the instances included
+    size_t VertexBufferSize() const
+    {
+        size_t size = 0;
+        for (const Mesh& mesh : meshes)
+            size += mesh.VertexBufferSize() + mesh.instanceTexCoords.size() * sizeof(glm::vec2);
+        return size;
+    }
+
+    // bytes of all index buffers on the GPU
+    size_t IndexBufferSize() const
+    {
+        size_t size = 0;
+        for (const Mesh& mesh : meshes)
+            size += mesh.IndexBufferSize();
+        return size;
+    }
+
 private:
+    // post-processing applied by ASSIMP on import, also part of the mesh cache key
+    static const unsigned int importFlags = aiProcess_Triangulate | aiProcess_GenSmoothNormals | aiProcess_FlipUVs | aiProcess_CalcTangentSpace;
+
     // loads a model with supported ASSIMP extensions from file and stores the resulting meshes in the meshes vector.
+    // the processed meshes are cached in a binary file next to the model, so ASSIMP only runs when the model changes.
     void loadModel(string const &path)
     {
+        // retrieve the directory path of the filepath
+        directory = path.substr(0, path.find_last_of('/'));
+
+        string cachePath = path + ".meshcache";
+        uint64_t sourceHash = 0;
+        bool hashed = rg::HashMeshSource(path, sourceHash);
+        if (hashed && loadFromCache(cachePath, sourceHash))
+        {
+            printCachedImportStats();
+            finishMeshes();
+            return;
+        }
+
         // read file via ASSIMP
         Assimp::Importer importer;
-        const aiScene* scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_GenSmoothNormals | aiProcess_FlipUVs | aiProcess_CalcTangentSpace);
+        const aiScene* scene = importer.ReadFile(path, importFlags);
         // check for errors
         if(!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) // if is Not Zero
         {
             cout << "ERROR::ASSIMP:: " << importer.GetErrorString() << endl;
             return;
         }
-        // retrieve the directory path of the filepath
-        directory = path.substr(0, path.find_last_of('/'));
 
-        // process ASSIMP's root node recursively
-        processNode(scene->mRootNode, scene);
+        // process ASSIMP's root node recursively; the vertex data of every mesh is converted, welded and
+        // optimized on the loader threads, everything touching GL or the model stays on this thread
+        vector<aiMesh*> sceneMeshes;
+        processNode(scene->mRootNode, scene, sceneMeshes);
+        vector<std::future<ImportedMesh>> imports;
+        imports.reserve(sceneMeshes.size());
+        for (aiMesh* mesh : sceneMeshes)
+            imports.push_back(rg::LoaderThreadPool().Submit([mesh] { return importMesh(mesh); }));
+        vector<ImportedMesh> imported;
+        imported.reserve(sceneMeshes.size());
+        for (std::future<ImportedMesh>& import : imports)
+            imported.push_back(import.get());
+
+        // a mesh with the geometry and material of an earlier one becomes another instance of it; a copy with
+        // a UV layout of its own only keeps its texture coordinates, which then follow the first mesh's vertices
+        // through welding and optimization
+        vector<int> copyOf = findRepeatedMeshes(sceneMeshes, imported);
+        vector<int> texCoordSet(sceneMeshes.size(), -1);
+        for (size_t i = 0; i < sceneMeshes.size(); i++)
+        {
+            if (copyOf[i] < 0)
+                continue;
+            ImportedMesh& first = imported[copyOf[i]];
+            vector<glm::vec2> texCoords(imported[i].vertices.size());
+            for (size_t j = 0; j < texCoords.size(); j++)
+                texCoords[j] = imported[i].vertices[j].TexCoords;
+            if (rg::SameTexCoords(first.vertices, texCoords))
+                continue;
+            texCoordSet[i] = (int)first.copyTexCoords.size();
+            first.copyTexCoords.push_back(std::move(texCoords));
+        }
+        vector<std::future<void>> optimized(sceneMeshes.size());
+        for (size_t i = 0; i < sceneMeshes.size(); i++)
+            if (copyOf[i] < 0)
+                optimized[i] = rg::LoaderThreadPool().Submit([&imported, i] { optimizeMesh(imported[i]); });
+
+        // start decoding every texture the materials reference behind the geometry jobs,
+        // so the decoders run while the meshes are uploaded
+        for(unsigned int i = 0; i < scene->mNumMaterials; i++)
+            prefetchMaterialTextures(scene->mMaterials[i]);
+
+        rg::VertexWeldStats welding;
+        vector<unsigned int> meshIndex(sceneMeshes.size());
+        for (size_t i = 0; i < sceneMeshes.size(); i++)
+        {
+            if (copyOf[i] >= 0)
+            {
+                meshIndex[i] = meshIndex[copyOf[i]];
+                continue;
+            }
+            optimized[i].get();
+            welding.before += imported[i].welding.before;
+            welding.after += imported[i].welding.after;
+            meshIndex[i] = (unsigned int)meshes.size();
+            meshes.push_back(processMesh(sceneMeshes[i], scene, imported[i]));
+            Mesh& mesh = meshes.back();
+            mesh.instances.clear();
+            for (const vector<glm::vec2>& texCoords : imported[i].copyTexCoords)
+                mesh.instanceTexCoords.insert(mesh.instanceTexCoords.end(), texCoords.begin(), texCoords.end());
+        }
+        // what the copies would have taken as meshes of their own, minus their texture coordinates
+        size_t savedBytes = 0;
+        for (size_t i = 0; i < sceneMeshes.size(); i++)
+        {
+            Mesh& mesh = meshes[meshIndex[i]];
+            mesh.instances.push_back(MeshInstance{glm::translate(glm::mat4(1.0f), imported[i].origin), texCoordSet[i]});
+            if (copyOf[i] >= 0)
+                savedBytes += mesh.VertexBufferSize() + mesh.IndexBufferSize()
+                              - (texCoordSet[i] >= 0 ? mesh.vertices.size() * sizeof(glm::vec2) : 0);
+        }
+        if (welding.before > 0)
+            cout << "Welded vertices of " << directory << ": " << welding.before << " -> " << welding.after
+                 << " (" << 100.0 * (double)(welding.before - welding.after) / (double)welding.before << "% fewer)" << endl;
+        cout << "Instanced repeated meshes of " << directory << ": " << sceneMeshes.size() << " meshes -> "
+             << meshes.size() << " unique, " << savedBytes / 1024 << " KB of GPU buffers saved" << endl;
+        // the cache keeps the meshes unbatched, batching is a load option
+        if (hashed)
+            rg::WriteMeshCache(cachePath, sourceHash, importFlags, meshes);
+        finishMeshes();
+    }
+
+    // batching (if enabled), textures, culling bounds and draw commands, the same for cached and imported meshes
+    void finishMeshes()
+    {
+        if (staticBatching)
+        {
+            batchStats = rg::BatchStaticMeshes(meshes);
+            cout << "Static batching of " << directory << ": " << batchStats.meshesBefore << " meshes -> "
+                 << batchStats.meshesAfter << ", " << batchStats.drawsBefore << " draws -> " << batchStats.drawsAfter
+                 << " per frame" << endl;
+        }
+        else
+        {
+            batchStats.meshesBefore = batchStats.meshesAfter = (unsigned int)meshes.size();
+            batchStats.drawsBefore = batchStats.drawsAfter = rg::DrawCommandCount(meshes);
+        }
+        finishTextures();
+        packBounds();
+        drawList.Build(meshes);
+    }
+
+    // fills meshes straight from a mesh cache file, returns false if there is no usable cache for this source
+    bool loadFromCache(string const &cachePath, uint64_t sourceHash)
+    {
+        rg::MeshCacheFile cache;
+        if (!cache.Open(cachePath, sourceHash, importFlags))
+            return false;
+
+        const rg::MeshCacheHeader& header = cache.Header();
+        meshes.reserve(header.meshCount);
+        for (unsigned int i = 0; i < header.meshCount; i++)
+        {
+            const rg::MeshCacheEntry& entry = cache.Entry(i);
+            const Vertex* vertexData = cache.Vertices(entry);
+            const unsigned int* indexData = cache.Indices(entry);
+            vector<Vertex> vertices(vertexData, vertexData + entry.vertexCount);
+            vector<unsigned int> indices(indexData, indexData + entry.indexCount);
+            vector<Texture> textures;
+            for (unsigned int j = 0; j < entry.textureRefCount; j++)
+            {
+                const rg::MeshCacheTextureRef& ref = cache.TextureRef(entry.firstTextureRef + j);
+                textures.push_back(loadTexture(cache.String(ref.pathOffset), cache.String(ref.typeOffset)));
+            }
+            meshes.emplace_back(std::move(vertices), std::move(indices), std::move(textures),
+                                glm::vec3(entry.aabbMin[0], entry.aabbMin[1], entry.aabbMin[2]),
+                                glm::vec3(entry.aabbMax[0], entry.aabbMax[1], entry.aabbMax[2]), vertexFormat);
+            Mesh& mesh = meshes.back();
+            mesh.instances.clear();
+            for (unsigned int j = 0; j < entry.instanceCount; j++)
+                mesh.instances.push_back(cache.Instance(entry.firstInstance + j));
+            const glm::vec2* texCoordData = cache.TexCoords(entry);
+            mesh.instanceTexCoords.assign(texCoordData, texCoordData + entry.texCoordCount);
+        }
+        return true;
+    }
+
+    // the import stats for meshes read from the cache, measured on what welding, optimization and instancing
+    // left behind; the counts before those steps are only known when ASSIMP runs
+    void printCachedImportStats() const
+    {
+        size_t vertexCount = 0, instanceCount = 0, savedBytes = 0;
+        for (size_t i = 0; i < meshes.size(); i++)
+        {
+            const Mesh& mesh = meshes[i];
+            rg::VertexCacheStats cacheStats = rg::AnalyzeVertexCache(mesh.indices, mesh.vertices.size());
+            cout << "Optimized mesh " << i << " of " << directory << " (" << mesh.indices.size() / 3
+                 << " triangles, cached): vertices " << mesh.vertices.size() << ", ACMR " << cacheStats.acmr
+                 << ", ATVR " << cacheStats.atvr << endl;
+            vertexCount += mesh.vertices.size();
+            instanceCount += mesh.instances.size();
+            for (size_t j = 1; j < mesh.instances.size(); j++)
+                savedBytes += mesh.VertexBufferSize() + mesh.IndexBufferSize()
+                              - (mesh.instances[j].texCoordSet >= 0 ? mesh.vertices.size() * sizeof(glm::vec2) : 0);
+        }
+        cout << "Welded vertices of " << directory << " (cached): " << vertexCount << " vertices" << endl;
+        cout << "Instanced repeated meshes of " << directory << " (cached): " << instanceCount << " meshes -> "
+             << meshes.size() << " unique, " << savedBytes / 1024 << " KB of GPU buffers saved" << endl;
     }
 
-    // processes a node in a recursive fashion. Processes each individual mesh located at the node and repeats this process on its children nodes (if any).
-    void processNode(aiNode *node, const aiScene *scene)
+    // processes a node in a recursive fashion. Collects each individual mesh located at the node and repeats this process on its children nodes (if any).
+    void processNode(aiNode *node, const aiScene *scene, vector<aiMesh*>& sceneMeshes)
     {
-        // process each mesh located at the current node
+        // collect each mesh located at the current node
         for(unsigned int i = 0; i < node->mNumMeshes; i++)
         {
             // the node object only contains indices to index the actual objects in the scene.
             // the scene contains all the data, node is just to keep stuff organized (like relations between nodes).
-            aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
-            meshes.push_back(processMesh(mesh, scene));
+            sceneMeshes.push_back(scene->mMeshes[node->mMeshes[i]]);
         }
-        // after we've processed all of the meshes (if any) we then recursively process each of the children nodes
+        // after we've collected all of the meshes (if any) we then recursively process each of the children nodes
         for(unsigned int i = 0; i < node->mNumChildren; i++)
         {
-            processNode(node->mChildren[i], scene);
+            processNode(node->mChildren[i], scene, sceneMeshes);
         }
 
     }
 
-    Mesh processMesh(aiMesh *mesh, const aiScene *scene)
+    // vertex data of one mesh in its local space, built on the loader threads
+    struct ImportedMesh
     {
-        // data to fill
         vector<Vertex> vertices;
         vector<unsigned int> indices;
-        vector<Texture> textures;
+        // where the local origin lies in the model and the hash of the local geometry
+        glm::vec3 origin;
+        uint64_t geometryHash;
+        // texture coordinates of copies with their own UV layout, per vertex; after optimizeMesh in the
+        // final vertex order
+        vector<vector<glm::vec2>> copyTexCoords;
+        rg::VertexWeldStats welding;
+        rg::MeshOptimizationStats optimization;
+    };
+
+    // only reads the ASSIMP mesh, safe to run on any thread while the scene is alive
+    static ImportedMesh importMesh(const aiMesh *mesh)
+    {
+        // data to fill
+        ImportedMesh imported;
+        vector<Vertex>& vertices = imported.vertices;
+        vector<unsigned int>& indices = imported.indices;
+        vertices.reserve(mesh->mNumVertices);
 
         // walk through each of the mesh's vertices
         for(unsigned int i = 0; i < mesh->mNumVertices; i++)
         {
-            Vertex vertex;
+            // value initialized, so attributes the mesh lacks are zero and weld together
+            Vertex vertex = Vertex();
             glm::vec3 vector; // we declare a placeholder vector since assimp_ uses its own vector class that doesn't directly convert to glm's vec3 class so we transfer the data to this placeholder glm::vec3 first.
             // positions
             vector.x = mesh->mVertices[i].x;
@@ -151,6 +459,54 @@ private:
             for(unsigned int j = 0; j < face.mNumIndices; j++)
                 indices.push_back(face.mIndices[j]);
         }
+
+        // into local space, so copies placed at different spots of the model hash alike
+        imported.origin = rg::CenterVertices(vertices);
+        imported.geometryHash = rg::HashGeometry(vertices, indices);
+        return imported;
+    }
+
+    // ASSIMP gives every triangle corner of an OBJ its own vertex, merge the identical ones; then
+    // reorder for the vertex cache, overdraw and vertex fetch. The cache stores the result,
+    // so this only runs when ASSIMP does
+    static void optimizeMesh(ImportedMesh &imported)
+    {
+        vector<uint32_t> classes = rg::TexCoordClasses(imported.copyTexCoords, imported.vertices.size());
+        vector<unsigned int> weldRemap, optimizeRemap;
+        imported.welding = rg::WeldVertices(imported.vertices, imported.indices, &classes, &weldRemap);
+        imported.optimization = rg::OptimizeMesh(imported.vertices, imported.indices, true, 1.05f, &optimizeRemap);
+        for (vector<glm::vec2>& texCoords : imported.copyTexCoords)
+            texCoords = rg::RemapTexCoords(texCoords, weldRemap, optimizeRemap, imported.vertices.size());
+    }
+
+    // for every mesh the index of the earlier mesh it repeats (same local geometry and material), -1 for the
+    // first occurrence of a geometry
+    static vector<int> findRepeatedMeshes(const vector<aiMesh*> &sceneMeshes, const vector<ImportedMesh> &imported)
+    {
+        vector<int> copyOf(sceneMeshes.size(), -1);
+        std::unordered_map<uint64_t, vector<int>> firstByHash;
+        for (size_t i = 0; i < sceneMeshes.size(); i++)
+        {
+            vector<int>& candidates = firstByHash[imported[i].geometryHash];
+            for (int candidate : candidates)
+            {
+                if (sceneMeshes[candidate]->mMaterialIndex == sceneMeshes[i]->mMaterialIndex
+                    && rg::SameGeometry(imported[candidate].vertices, imported[candidate].indices,
+                                        imported[i].vertices, imported[i].indices))
+                {
+                    copyOf[i] = candidate;
+                    break;
+                }
+            }
+            if (copyOf[i] < 0)
+                candidates.push_back((int)i);
+        }
+        return copyOf;
+    }
+
+    Mesh processMesh(aiMesh *mesh, const aiScene *scene, ImportedMesh& imported)
+    {
+        vector<Texture> textures;
         // process materials
         aiMaterial* material = scene->mMaterials[mesh->mMaterialIndex];
         // we assume a convention for sampler names in the shaders. Each diffuse texture should be named
@@ -178,8 +534,14 @@ private:
 
 
 
+        const rg::MeshOptimizationStats& optimization = imported.optimization;
+        cout << "Optimized mesh " << meshes.size() << " '" << mesh->mName.C_Str() << "' of " << directory << " (" << imported.indices.size() / 3
+             << " triangles): vertices " << imported.welding.before << " -> " << imported.vertices.size()
+             << ", ACMR " << optimization.before.acmr << " -> " << optimization.after.acmr
+             << ", ATVR " << optimization.before.atvr << " -> " << optimization.after.atvr << endl;
+
         // return a mesh object created from the extracted mesh data
-        return Mesh(vertices, indices, textures);
+        return Mesh(std::move(imported.vertices), std::move(imported.indices), textures, vertexFormat);
     }
 
     // checks all material textures of a given type and loads the textures if they're not loaded yet.
@@ -191,29 +553,159 @@ private:
         {
             aiString str;
             mat->GetTexture(type, i, &str);
-            // check if texture was loaded before and if so, continue to next iteration: skip loading a new texture
-            bool skip = false;
-            for(unsigned int j = 0; j < textures_loaded.size(); j++)
+            textures.push_back(loadTexture(str.C_Str(), typeName));
+        }
+        return textures;
+    }
+
+    void prefetchMaterialTextures(aiMaterial *mat)
+    {
+        loadMaterialTextures(mat, aiTextureType_DIFFUSE, "texture_diffuse");
+        loadMaterialTextures(mat, aiTextureType_SPECULAR, "texture_specular");
+        loadMaterialTextures(mat, aiTextureType_HEIGHT, "texture_normal");
+        loadMaterialTextures(mat, aiTextureType_AMBIENT, "texture_height");
+    }
+
+    // requests a single texture of the model, unless a texture with the same path has already been requested.
+    // the image is only decoded here (on a loader thread); until finishTextures() uploads it, id holds the loader slot.
+    Texture loadTexture(const char *path, const string &typeName)
+    {
+        // check if texture was loaded before and if so, skip loading a new texture
+        for(unsigned int j = 0; j < textures_loaded.size(); j++)
+        {
+            if(std::strcmp(textures_loaded[j].path.data(), path) == 0)
+                return textures_loaded[j]; // a texture with the same filepath has already been loaded (optimization)
+        }
+        // if texture hasn't been loaded already, load it
+        Texture texture;
+        // diffuse maps are colors: their mips are averaged in linear light, and sampled as sRGB with gammaCorrection;
+        // maps of a type the shader never samples are neither decoded nor uploaded until LoadTextures asks for them
+        texture.deferred = !textureUsage.Uses(typeName);
+        texture.id = texture.deferred ? 0 : textureLoader.Request(this->directory + '/' + path,
+                                                                  typeName == "texture_diffuse");
+        texture.type = typeName;
+        texture.path = path;
+        textures_loaded.push_back(texture);  // store it as texture loaded for entire model, to ensure we won't unnecesery load duplicate textures.
+        return texture;
+    }
+
+    // uploads all requested textures into texture arrays on this (the GL) thread and swaps the loader slots
+    // for the array and layer each image ended up in; deferred textures are left as they are,
+    // already resolved ones only pick up the id of their array, which a later upload may have recreated
+    void finishTextures()
+    {
+        vector<rg::TextureArrayLayer> layers = textureLoader.UploadAllAsArrays(textureArrays);
+        auto resolve = [&](Texture& texture) {
+            // an array the new layers went into was recreated under a new id
+            if (texture.resolved)
+                texture.id = texture.array >= 0 ? textureArrays.Id(texture.array) : 0;
+            if (texture.deferred || texture.resolved)
+                return;
+            texture.resolved = true;
+            const rg::TextureArrayLayer& layer = layers[texture.id];
+            texture.array = layer.array;
+            texture.layer = layer.layer;
+            texture.color = glm::vec4(layer.color[0], layer.color[1], layer.color[2], layer.color[3]);
+            texture.id = layer.array >= 0 ? textureArrays.Id(layer.array) : 0;
+        };
+        for (Texture& texture : textures_loaded)
+            resolve(texture);
+        for (Mesh& mesh : meshes)
+            for (Texture& texture : mesh.textures)
+                resolve(texture);
+        textureStats = textureLoader.Stats();
+        cout << "Loaded " << textureStats.textureCount << " textures from " << directory
+             << ": decode " << textureStats.decodeMs << " ms (" << rg::LoaderThreadPool().Size() << " threads)"
+             << ", upload " << textureStats.uploadMs << " ms, wall " << textureStats.wallMs << " ms"
+             << ", " << textureStats.cookedCount << " compressed, " << textureStats.cachedCount << " from cache, "
+             << textureStats.constantCount << " constant, " << textureStats.reducedCount << " downscaled, "
+             << textureStats.gpuBytes / 1024 << " KB texture memory" << endl;
+        if (textureStats.shrunkCount > 0 || textureStats.leftOutCount > 0)
+            cout << "ERROR::MODEL::OUT_OF_TEXTURE_ARRAYS " << directory << ": " << textureStats.shrunkCount
+                 << " textures stored at a smaller mip level, " << textureStats.leftOutCount << " left out" << endl;
+    }
+
+    // the maps left for LoadTextures, once after loading
+    void printDeferredTextures() const
+    {
+        unsigned int deferredCount = 0;
+        for (const Texture& texture : textures_loaded)
+            deferredCount += texture.deferred ? 1 : 0;
+        if (deferredCount > 0)
+            cout << "Skipped " << deferredCount << " textures of " << directory << " the shader does not sample (it uses "
+                 << textureUsage.Describe() << ")" << endl;
+    }
+
+    // GPU buffer sizes and the index width every mesh ended up with
+    void printMemoryReport(string const &path) const
+    {
+        unsigned int shortMeshes = 0, splitMeshes = 0, splitRanges = 0, intMeshes = 0;
+        size_t fullIndexSize = 0;
+        for (const Mesh& mesh : meshes) {
+            fullIndexSize += mesh.indices.size() * sizeof(unsigned int);
+            if (mesh.indexType == GL_UNSIGNED_INT)
+                intMeshes++;
+            else if (mesh.indexRanges.size() > 1) {
+                splitMeshes++;
+                splitRanges += (unsigned int)mesh.indexRanges.size();
+            } else
+                shortMeshes++;
+        }
+        cout << "Memory of " << path << ": vertex buffers " << VertexBufferSize() / 1024 << " KB ("
+             << rg::VertexFormatName(vertexFormat) << " vertices), index buffers " << IndexBufferSize() / 1024
+             << " KB (32-bit: " << fullIndexSize / 1024 << " KB; " << shortMeshes << " meshes 16-bit, "
+             << splitMeshes << " split into " << splitRanges << " 16-bit ranges, " << intMeshes << " 32-bit), "
+             << meshes.size() << " meshes drawn as " << InstanceCount() << " instances" << endl;
+    }
+
+    rg::IndirectDrawStats drawMeshes(const vector<unsigned char> *visible, bool multiDraw)
+    {
+        rg::IndirectDrawStats stats;
+        drawList.Draw(visible, multiDraw, stats);
+        return stats;
+    }
+
+    // box and sphere of one placed copy of a mesh in the object space of the model
+    static void instanceBounds(const Mesh &mesh, const glm::mat4 &transform, glm::vec3 &aabbMin, glm::vec3 &aabbMax,
+                               float &radius)
+    {
+        aabbMin = mesh.aabbMin;
+        aabbMax = mesh.aabbMax;
+        radius = mesh.boundingRadius;
+        rg::TransformBounds(transform, aabbMin, aabbMax, radius);
+    }
+
+    // bounds of all objects in the order IndirectDrawList numbers them, packed for the culling tests: the
+    // instances of each mesh, or the sub meshes of a static batch
+    void packBounds()
+    {
+        bounds.Clear();
+        for (const Mesh& mesh : meshes)
+        {
+            for (const SubMesh& subMesh : mesh.subMeshes)
+                bounds.Add(subMesh.aabbMin, subMesh.aabbMax, subMesh.boundingRadius);
+            if (!mesh.subMeshes.empty())
+                continue;
+            for (const MeshInstance& instance : mesh.instances)
             {
-                if(std::strcmp(textures_loaded[j].path.data(), str.C_Str()) == 0)
-                {
-                    textures.push_back(textures_loaded[j]);
-                    skip = true; // a texture with the same filepath has already been loaded, continue to next one. (optimization)
-                    break;
-                }
-            }
-            if(!skip)
-            {   // if texture hasn't been loaded already, load it
-                Texture texture;
-                texture.id = TextureFromFile(str.C_Str(), this->directory);
-                texture.type = typeName;
-                texture.path = str.C_Str();
-                textures.push_back(texture);
-                textures_loaded.push_back(texture);  // store it as texture loaded for entire model, to ensure we won't unnecesery load duplicate textures.
+                glm::vec3 instanceMin, instanceMax;
+                float radius;
+                instanceBounds(mesh, instance.transform, instanceMin, instanceMax, radius);
+                bounds.Add(instanceMin, instanceMax, radius);
             }
         }
-        return textures;
     }
+
+    // map types loaded so far, the rest stay deferred
+    rg::TextureUsage textureUsage;
+    bool staticBatching;
+    rg::TextureLoader textureLoader;
+    rg::PackedBounds bounds;
+    vector<unsigned char> visibleObjects;
+    // indirect commands and per-draw data of all meshes
+    rg::IndirectDrawList drawList;
+    // every texture of the model, bound to units 0..n-1 for the whole model
+    rg::TextureArraySet textureArrays;
 };
 
 
@@ -225,34 +717,35 @@ unsigned int TextureFromFile(const char *path, const string &directory, bool gam
     unsigned int textureID;
     glGenTextures(1, &textureID);
 
-    int width, height, nrComponents;
-    unsigned char *data = stbi_load(filename.c_str(), &width, &height, &nrComponents, 0);
-    if (data)
+    rg::DecodedImage image = rg::DecodeImage(filename);
+    if (rg::ImageLoaded(image))
     {
-        GLenum format;
-        if (nrComponents == 1)
-            format = GL_RED;
-        else if (nrComponents == 3)
-            format = GL_RGB;
-        else if (nrComponents == 4)
-            format = GL_RGBA;
-
+        GLenum format = rg::PixelFormat(image.components);
         glBindTexture(GL_TEXTURE_2D, textureID);
-        glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glTexImage2D(GL_TEXTURE_2D, 0, format, image.width, image.height, 0, format, GL_UNSIGNED_BYTE, image.data);
+        for (size_t level = 0; level < image.mips.size(); level++)
+        {
+            const rg::MipLevel& mip = image.mips[level];
+            glTexImage2D(GL_TEXTURE_2D, (GLint)level + 1, format, mip.width, mip.height, 0, format, GL_UNSIGNED_BYTE,
+                         mip.pixels.data());
+        }
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint)image.mips.size());
+        if (image.components == 2)
+            rg::SetLuminanceAlphaSwizzle(GL_TEXTURE_2D);
 
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-        stbi_image_free(data);
+        rg::GLCache().Invalidate();
     }
     else
     {
         std::cout << "Texture failed to load at path: " << path << std::endl;
-        stbi_image_free(data);
     }
+    stbi_image_free(image.data);
 
     return textureID;
 }
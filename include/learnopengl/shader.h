@@ -4,18 +4,49 @@
 #include <glad/glad.h>
 #include <glm/glm.hpp>
 
+#include <cstdint>
 #include <string>
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <vector>
 #include <common.h>
+#include <rg/GLState.h>
+
+// 32-bit FNV-1a over a NUL-terminated string, usable in constant expressions
+constexpr uint32_t HashUniformName(const char* name, uint32_t hash = 2166136261u)
+{
+    while (*name)
+    {
+        hash ^= (unsigned char)*name++;
+        hash *= 16777619u;
+    }
+    return hash != 0 ? hash : 1; // 0 marks an empty slot in the location table
+}
+
+// Identifies a uniform by the hash of its name. Implicitly built from string literals and std::strings,
+// so the setters below never allocate; "name"_uniform forces the hash to be computed at compile time.
+struct UniformId
+{
+    uint32_t hash;
+    constexpr UniformId(const char* name) : hash(HashUniformName(name)) {}
+    UniformId(const std::string& name) : hash(HashUniformName(name.c_str())) {}
+};
+
+constexpr UniformId operator"" _uniform(const char* name, size_t)
+{
+    return UniformId(name);
+}
+
 class Shader
 {
 public:
     unsigned int ID;
     // constructor generates the shader on the fly
+    // defines (e.g. "#define BLOOM\n") are inserted right after the #version line of every stage
     // ------------------------------------------------------------------------
-    Shader(const char* vertexPath, const char* fragmentPath, const char* geometryPath = nullptr)
+    Shader(const char* vertexPath, const char* fragmentPath, const char* geometryPath = nullptr,
+           const std::string& defines = std::string())
     {
         std::string vertexPathString(vertexPath);
         std::string fragmentPathString(fragmentPath);
@@ -64,6 +95,9 @@ public:
         {
             std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << std::endl;
         }
+        vertexCode = insertDefines(vertexCode, defines);
+        fragmentCode = insertDefines(fragmentCode, defines);
+        geometryCode = insertDefines(geometryCode, defines);
         const char* vShaderCode = vertexCode.c_str();
         const char * fShaderCode = fragmentCode.c_str();
         // 2. compile shaders
@@ -96,6 +130,7 @@ public:
             glAttachShader(ID, geometry);
         glLinkProgram(ID);
         checkCompileErrors(ID, "PROGRAM");
+        cacheUniformLocations();
         // delete the shaders as they're linked into our program now and no longer necessery
         glDeleteShader(vertex);
         glDeleteShader(fragment);
@@ -107,68 +142,157 @@ public:
     // ------------------------------------------------------------------------
     void use() 
     { 
-        glUseProgram(ID); 
+        rg::GLCache().UseProgram(ID);
     }
     // utility uniform functions
     // ------------------------------------------------------------------------
-    void setBool(const std::string &name, bool value) const
+    void setBool(UniformId name, bool value) const
     {         
-        glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value); 
+        glUniform1i(location(name), (int)value); 
     }
     // ------------------------------------------------------------------------
-    void setInt(const std::string &name, int value) const
+    void setInt(UniformId name, int value) const
     { 
-        glUniform1i(glGetUniformLocation(ID, name.c_str()), value); 
+        glUniform1i(location(name), value); 
     }
     // ------------------------------------------------------------------------
-    void setFloat(const std::string &name, float value) const
+    void setFloat(UniformId name, float value) const
     { 
-        glUniform1f(glGetUniformLocation(ID, name.c_str()), value); 
+        glUniform1f(location(name), value); 
     }
     // ------------------------------------------------------------------------
-    void setVec2(const std::string &name, const glm::vec2 &value) const
+    void setVec2(UniformId name, const glm::vec2 &value) const
     { 
-        glUniform2fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]); 
+        glUniform2fv(location(name), 1, &value[0]); 
     }
-    void setVec2(const std::string &name, float x, float y) const
+    void setVec2(UniformId name, float x, float y) const
     { 
-        glUniform2f(glGetUniformLocation(ID, name.c_str()), x, y); 
+        glUniform2f(location(name), x, y); 
     }
     // ------------------------------------------------------------------------
-    void setVec3(const std::string &name, const glm::vec3 &value) const
+    void setVec3(UniformId name, const glm::vec3 &value) const
     { 
-        glUniform3fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]); 
+        glUniform3fv(location(name), 1, &value[0]); 
     }
-    void setVec3(const std::string &name, float x, float y, float z) const
+    void setVec3(UniformId name, float x, float y, float z) const
     { 
-        glUniform3f(glGetUniformLocation(ID, name.c_str()), x, y, z); 
+        glUniform3f(location(name), x, y, z); 
     }
     // ------------------------------------------------------------------------
-    void setVec4(const std::string &name, const glm::vec4 &value) const
+    void setVec4(UniformId name, const glm::vec4 &value) const
     { 
-        glUniform4fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]); 
+        glUniform4fv(location(name), 1, &value[0]); 
     }
-    void setVec4(const std::string &name, float x, float y, float z, float w) 
+    void setVec4(UniformId name, float x, float y, float z, float w) 
     { 
-        glUniform4f(glGetUniformLocation(ID, name.c_str()), x, y, z, w); 
+        glUniform4f(location(name), x, y, z, w); 
+    }
+    // ------------------------------------------------------------------------
+    void setMat2(UniformId name, const glm::mat2 &mat) const
+    {
+        glUniformMatrix2fv(location(name), 1, GL_FALSE, &mat[0][0]);
     }
     // ------------------------------------------------------------------------
-    void setMat2(const std::string &name, const glm::mat2 &mat) const
+    void setMat3(UniformId name, const glm::mat3 &mat) const
     {
-        glUniformMatrix2fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        glUniformMatrix3fv(location(name), 1, GL_FALSE, &mat[0][0]);
     }
     // ------------------------------------------------------------------------
-    void setMat3(const std::string &name, const glm::mat3 &mat) const
+    void setMat4(UniformId name, const glm::mat4 &mat) const
     {
-        glUniformMatrix3fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        glUniformMatrix4fv(location(name), 1, GL_FALSE, &mat[0][0]);
+    }
+
+    // connects a uniform block to a buffer binding point, does nothing if the program has no such block
+    void BindUniformBlock(const char* blockName, unsigned int binding) const
+    {
+        GLuint index = glGetUniformBlockIndex(ID, blockName);
+        if (index != GL_INVALID_INDEX)
+            glUniformBlockBinding(ID, index, binding);
     }
     // ------------------------------------------------------------------------
-    void setMat4(const std::string &name, const glm::mat4 &mat) const
+    // location of an active uniform, -1 (ignored by glUniform*) if the program has no such uniform
+    GLint location(UniformId name) const
     {
-        glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        uint32_t mask = (uint32_t)uniformHashes.size() - 1;
+        for (uint32_t slot = name.hash & mask; uniformHashes[slot] != 0; slot = (slot + 1) & mask)
+        {
+            if (uniformHashes[slot] == name.hash)
+                return uniformLocations[slot];
+        }
+        return -1;
     }
 
 private:
+    // open addressing table from uniform name hash to location, filled once after linking
+    std::vector<uint32_t> uniformHashes;
+    std::vector<GLint> uniformLocations;
+
+    // introspects all active uniforms of the linked program, so setting a uniform never asks the driver again
+    void cacheUniformLocations()
+    {
+        GLint count = 0, maxLength = 0;
+        glGetProgramiv(ID, GL_ACTIVE_UNIFORMS, &count);
+        glGetProgramiv(ID, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+
+        std::vector<std::pair<std::string, GLint>> uniforms;
+        std::vector<GLchar> nameBuffer(maxLength + 1);
+        for (GLint i = 0; i < count; i++)
+        {
+            GLint size;
+            GLenum type;
+            glGetActiveUniform(ID, (GLuint)i, (GLsizei)nameBuffer.size(), NULL, &size, &type, nameBuffer.data());
+            std::string name(nameBuffer.data());
+            GLint loc = glGetUniformLocation(ID, name.c_str());
+            if (loc < 0) // members of uniform blocks have no location
+                continue;
+            uniforms.emplace_back(name, loc);
+            // arrays are reported as "name[0]", make "name" and every element reachable as well
+            std::string::size_type bracket = name.rfind("[0]");
+            if (bracket != std::string::npos && bracket + 3 == name.size())
+            {
+                std::string base = name.substr(0, bracket);
+                uniforms.emplace_back(base, loc);
+                for (GLint element = 1; element < size; element++)
+                {
+                    std::string elementName = base + "[" + std::to_string(element) + "]";
+                    uniforms.emplace_back(elementName, glGetUniformLocation(ID, elementName.c_str()));
+                }
+            }
+        }
+
+        uint32_t capacity = 16;
+        while (capacity < uniforms.size() * 2)
+            capacity *= 2;
+        uniformHashes.assign(capacity, 0);
+        uniformLocations.assign(capacity, -1);
+        for (const auto& uniform : uniforms)
+        {
+            uint32_t hash = HashUniformName(uniform.first.c_str());
+            uint32_t slot = hash & (capacity - 1);
+            while (uniformHashes[slot] != 0 && uniformHashes[slot] != hash)
+                slot = (slot + 1) & (capacity - 1);
+            if (uniformHashes[slot] == hash && uniformLocations[slot] != uniform.second)
+                std::cout << "ERROR::SHADER::UNIFORM_HASH_COLLISION " << uniform.first << std::endl;
+            uniformHashes[slot] = hash;
+            uniformLocations[slot] = uniform.second;
+        }
+    }
+
+    // inserts preprocessor lines after #version, which has to stay the first directive
+    // ------------------------------------------------------------------------
+    static std::string insertDefines(const std::string& code, const std::string& defines)
+    {
+        if (defines.empty() || code.empty())
+            return code;
+        size_t versionLine = code.find("#version");
+        size_t insertAt = versionLine == std::string::npos ? 0 : code.find('\n', versionLine);
+        if (insertAt == std::string::npos)
+            return code + "\n" + defines;
+        insertAt = versionLine == std::string::npos ? 0 : insertAt + 1;
+        return code.substr(0, insertAt) + defines + code.substr(insertAt);
+    }
+
     // utility function for checking shader compilation/linking errors.
     // ------------------------------------------------------------------------
     void checkCompileErrors(GLuint shader, std::string type)
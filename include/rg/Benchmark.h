@@ -0,0 +1,292 @@
+//
+// Headless benchmark mode: command line options, a scripted camera path replayed with a fixed timestep,
+// per-frame timing reports and image captures.
+//
+
+#ifndef PROJECT_BASE_BENCHMARK_H
+#define PROJECT_BASE_BENCHMARK_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <rg/Profiler.h>
+#include <rg/VertexPacking.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace rg {
+
+    struct BenchmarkOptions {
+        bool enabled = false;
+        bool egl = false;            // EGL context, surfaceless where GLFW supports the null platform
+        unsigned int frames = 600;
+        unsigned int warmupFrames = 30;  // rendered but left out of the report (shader compilation, first uploads)
+        float timestep = 1.0f / 60.0f;
+        int lights = -1;             // benchmark light count, -1 keeps the saved one
+        std::string cameraPath;      // keyframe file, the built-in path through the lodge if empty
+        std::string csvPath = "benchmark.csv";
+        unsigned int captureEvery = 0;   // write every n-th frame as a PPM image, 0 disables captures
+        std::string capturePrefix = "benchmark_frame_";
+        // vertex layout of the models, also honoured outside benchmark runs
+        VertexFormat vertexFormat = VertexFormat::Full;
+        // draw the models with glMultiDrawElementsIndirect where supported, also honoured outside benchmark runs
+        bool multiDrawIndirect = true;
+        // BC1/BC3/BC4/BC5 model textures, cooked once into .texcache files; also honoured outside benchmark runs
+        bool compressTextures = true;
+        // merge the meshes sharing a material into one draw at load; also honoured outside benchmark runs
+        bool staticBatching = false;
+        // time the scalar and SIMD mip filters on the scene's textures and exit, no window is opened
+        bool mipBenchmark = false;
+    };
+
+    inline void PrintBenchmarkUsage(const char* program)
+    {
+        std::cout << "usage: " << program << " [--benchmark [options]]\n"
+                  << "  --frames N           frames to measure (default 600)\n"
+                  << "  --warmup N           frames rendered before measuring (default 30)\n"
+                  << "  --timestep S         simulated seconds per frame (default 1/60)\n"
+                  << "  --lights N           number of benchmark point lights\n"
+                  << "  --camera-path FILE   keyframes, one 't px py pz tx ty tz' per line\n"
+                  << "  --csv FILE           per-frame timings (default benchmark.csv)\n"
+                  << "  --capture-every N    save every N-th measured frame as PPM\n"
+                  << "  --capture-prefix P   path prefix of the captures (default benchmark_frame_)\n"
+                  << "  --egl                create the context through EGL (surfaceless with GLFW 3.4+)\n"
+                  << "  --vertex-format F    full (default), packed or packed-float vertex buffers\n"
+                  << "  --no-multi-draw      one draw call per mesh instead of glMultiDrawElementsIndirect\n"
+                  << "  --no-texture-compression  upload model textures uncompressed\n"
+                  << "  --static-batching    merge the meshes of each material into one draw at load\n"
+                  << "  --mip-benchmark      compare the scalar and SIMD mip generators and exit" << std::endl;
+    }
+
+    // returns false (after printing usage) on unknown or malformed arguments
+    inline bool ParseBenchmarkOptions(int argc, char** argv, BenchmarkOptions& options)
+    {
+        for (int i = 1; i < argc; i++) {
+            std::string arg = argv[i];
+            bool hasValue = i + 1 < argc;
+            if (arg == "--benchmark") {
+                options.enabled = true;
+            } else if (arg == "--egl") {
+                options.egl = true;
+            } else if (arg == "--frames" && hasValue) {
+                options.frames = (unsigned int)std::max(1, std::atoi(argv[++i]));
+            } else if (arg == "--warmup" && hasValue) {
+                options.warmupFrames = (unsigned int)std::max(0, std::atoi(argv[++i]));
+            } else if (arg == "--timestep" && hasValue) {
+                options.timestep = (float)std::atof(argv[++i]);
+            } else if (arg == "--lights" && hasValue) {
+                options.lights = std::max(0, std::atoi(argv[++i]));
+            } else if (arg == "--camera-path" && hasValue) {
+                options.cameraPath = argv[++i];
+            } else if (arg == "--csv" && hasValue) {
+                options.csvPath = argv[++i];
+            } else if (arg == "--capture-every" && hasValue) {
+                options.captureEvery = (unsigned int)std::max(0, std::atoi(argv[++i]));
+            } else if (arg == "--capture-prefix" && hasValue) {
+                options.capturePrefix = argv[++i];
+            } else if (arg == "--no-multi-draw") {
+                options.multiDrawIndirect = false;
+            } else if (arg == "--no-texture-compression") {
+                options.compressTextures = false;
+            } else if (arg == "--static-batching") {
+                options.staticBatching = true;
+            } else if (arg == "--mip-benchmark") {
+                options.mipBenchmark = true;
+            } else if (arg == "--vertex-format" && hasValue) {
+                std::string format = argv[++i];
+                if (format == VertexFormatName(VertexFormat::Full))
+                    options.vertexFormat = VertexFormat::Full;
+                else if (format == VertexFormatName(VertexFormat::Packed))
+                    options.vertexFormat = VertexFormat::Packed;
+                else if (format == VertexFormatName(VertexFormat::PackedFloatPosition))
+                    options.vertexFormat = VertexFormat::PackedFloatPosition;
+                else {
+                    std::cout << "ERROR::BENCHMARK::UNKNOWN_VERTEX_FORMAT " << format << std::endl;
+                    return false;
+                }
+            } else {
+                std::cout << "ERROR::BENCHMARK::UNKNOWN_ARGUMENT " << arg << std::endl;
+                PrintBenchmarkUsage(argv[0]);
+                return false;
+            }
+        }
+        if (options.timestep <= 0.0f) {
+            std::cout << "ERROR::BENCHMARK::INVALID_TIMESTEP" << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    // Looping Catmull-Rom path over (time, position, look-at target) keyframes.
+    class CameraPath {
+    public:
+        struct Keyframe {
+            float time;
+            glm::vec3 position;
+            glm::vec3 target;
+        };
+
+        // a lap around the lodge: entrance, both lamps, the horse and back
+        static CameraPath Default()
+        {
+            CameraPath path;
+            path.keys = {
+                    {0.0f,  glm::vec3(-4.4f, 12.7f, 34.4f), glm::vec3(5.0f, 6.0f, 10.0f)},
+                    {2.0f,  glm::vec3(5.6f, 6.0f, 18.0f),   glm::vec3(20.0f, 8.0f, 26.5f)},
+                    {4.0f,  glm::vec3(18.0f, 5.0f, 5.0f),   glm::vec3(0.0f, 4.0f, -10.0f)},
+                    {6.0f,  glm::vec3(0.0f, 5.0f, -15.0f),  glm::vec3(-37.0f, 4.0f, -35.0f)},
+                    {8.0f,  glm::vec3(-25.0f, 4.0f, -20.0f), glm::vec3(-37.0f, 3.0f, -35.0f)},
+                    {10.0f, glm::vec3(-30.0f, 8.0f, 5.0f),  glm::vec3(0.0f, 5.0f, 0.0f)},
+                    {12.0f, glm::vec3(-4.4f, 12.7f, 34.4f), glm::vec3(5.0f, 6.0f, 10.0f)},
+            };
+            return path;
+        }
+
+        // one keyframe 't px py pz tx ty tz' per line, '#' starts a comment; times must increase
+        bool LoadFromFile(const std::string& filename)
+        {
+            std::ifstream in(filename);
+            if (!in) {
+                std::cout << "ERROR::BENCHMARK::CAMERA_PATH_NOT_FOUND " << filename << std::endl;
+                return false;
+            }
+            keys.clear();
+            std::string line;
+            while (std::getline(in, line)) {
+                line = line.substr(0, line.find('#'));
+                std::istringstream fields(line);
+                Keyframe key;
+                if (!(fields >> key.time))
+                    continue;
+                if (!(fields >> key.position.x >> key.position.y >> key.position.z
+                             >> key.target.x >> key.target.y >> key.target.z)
+                    || (!keys.empty() && key.time <= keys.back().time)) {
+                    std::cout << "ERROR::BENCHMARK::CAMERA_PATH_INVALID_LINE " << line << std::endl;
+                    return false;
+                }
+                keys.push_back(key);
+            }
+            if (keys.size() < 2) {
+                std::cout << "ERROR::BENCHMARK::CAMERA_PATH_NEEDS_TWO_KEYFRAMES " << filename << std::endl;
+                return false;
+            }
+            return true;
+        }
+
+        float Duration() const { return keys.back().time - keys.front().time; }
+
+        // camera position and look-at target at time t, wrapping around after the last keyframe
+        void Evaluate(float t, glm::vec3& position, glm::vec3& target) const
+        {
+            float duration = Duration();
+            t = keys.front().time + (duration > 0.0f ? std::fmod(t, duration) : 0.0f);
+            size_t i = 0;
+            while (i + 2 < keys.size() && keys[i + 1].time <= t)
+                i++;
+            const Keyframe& k1 = keys[i];
+            const Keyframe& k2 = keys[i + 1];
+            const Keyframe& k0 = keys[i > 0 ? i - 1 : i];
+            const Keyframe& k3 = keys[std::min(i + 2, keys.size() - 1)];
+            float u = glm::clamp((t - k1.time) / (k2.time - k1.time), 0.0f, 1.0f);
+            position = catmullRom(k0.position, k1.position, k2.position, k3.position, u);
+            target = catmullRom(k0.target, k1.target, k2.target, k3.target, u);
+        }
+
+    private:
+        std::vector<Keyframe> keys;
+
+        static glm::vec3 catmullRom(glm::vec3 p0, glm::vec3 p1, glm::vec3 p2, glm::vec3 p3, float u)
+        {
+            float u2 = u * u;
+            float u3 = u2 * u;
+            return 0.5f * (2.0f * p1 + (p2 - p0) * u + (2.0f * p0 - 5.0f * p1 + 4.0f * p2 - p3) * u2
+                           + (3.0f * p1 - p0 - 3.0f * p2 + p3) * u3);
+        }
+    };
+
+    // yaw/pitch (degrees, as used by Camera) looking from position towards target
+    inline void LookAtAngles(glm::vec3 position, glm::vec3 target, float& yaw, float& pitch)
+    {
+        glm::vec3 direction = glm::normalize(target - position);
+        yaw = glm::degrees(std::atan2(direction.z, direction.x));
+        pitch = glm::degrees(std::asin(glm::clamp(direction.y, -1.0f, 1.0f)));
+    }
+
+    // reads back the bound read framebuffer (RGBA8) and writes it as a binary PPM, top row first
+    inline bool CaptureFramebuffer(const std::string& filename, unsigned int width, unsigned int height)
+    {
+        std::vector<unsigned char> pixels(width * height * 3);
+        glPixelStorei(GL_PACK_ALIGNMENT, 1);
+        glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, pixels.data());
+        std::ofstream out(filename, std::ios::binary);
+        if (!out) {
+            std::cout << "ERROR::BENCHMARK::CANNOT_WRITE " << filename << std::endl;
+            return false;
+        }
+        out << "P6\n" << width << " " << height << "\n255\n";
+        for (unsigned int y = height; y-- > 0;)
+            out.write((const char*)pixels.data() + y * width * 3, width * 3);
+        return (bool)out;
+    }
+
+    // writes one row per recorded frame (cpu/gpu ms of every stage) and prints a percentile summary; warmup
+    // frames are never recorded (Profiler::RecordFrames)
+    inline bool WriteBenchmarkReport(const Profiler& profiler, const std::string& csvPath)
+    {
+        const std::vector<Profiler::Stage>& stages = profiler.Stages();
+        const std::vector<Profiler::FrameTimes>& frames = profiler.Frames();
+        std::ofstream out(csvPath);
+        if (!out) {
+            std::cout << "ERROR::BENCHMARK::CANNOT_WRITE " << csvPath << std::endl;
+            return false;
+        }
+        out << "frame,cpu_ms,gpu_ms";
+        for (const Profiler::Stage& stage : stages)
+            out << "," << stage.name << " cpu_ms," << stage.name << " gpu_ms";
+        out << "\n";
+
+        std::vector<double> cpuMs, gpuMs;
+        for (size_t f = 0; f < frames.size(); f++) {
+            const Profiler::FrameTimes& times = frames[f];
+            double gpuTotal = 0.0;
+            for (float ms : times.stageGpuMs)
+                gpuTotal += ms;
+            cpuMs.push_back(times.cpuMs);
+            gpuMs.push_back(gpuTotal);
+            out << f << "," << times.cpuMs << "," << gpuTotal;
+            for (size_t s = 0; s < stages.size(); s++) {
+                if (s < times.stageCpuMs.size())
+                    out << "," << times.stageCpuMs[s] << "," << times.stageGpuMs[s];
+                else
+                    out << ",0,0";
+            }
+            out << "\n";
+        }
+
+        auto report = [](const char* label, std::vector<double> samples) {
+            if (samples.empty())
+                return;
+            std::sort(samples.begin(), samples.end());
+            double sum = 0.0;
+            for (double ms : samples)
+                sum += ms;
+            auto percentile = [&samples](double p) { return samples[(size_t)(p * (samples.size() - 1) + 0.5)]; };
+            std::cout << "Benchmark: " << label << " mean " << sum / samples.size() << " ms, median " << percentile(0.5)
+                      << " ms, p95 " << percentile(0.95) << " ms, p99 " << percentile(0.99) << " ms, max "
+                      << samples.back() << " ms" << std::endl;
+        };
+        std::cout << "Benchmark: " << cpuMs.size() << " frames written to " << csvPath << std::endl;
+        report("CPU frame", cpuMs);
+        report("GPU frame", gpuMs);
+        return (bool)out;
+    }
+}
+
+#endif //PROJECT_BASE_BENCHMARK_H
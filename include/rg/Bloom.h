@@ -0,0 +1,110 @@
+//
+// Dual filter (Kawase style) bloom: the source is downsampled through a chain of half resolution
+// targets and upsampled back, every pass reading five or eight bilinear taps.
+//
+
+#ifndef PROJECT_BASE_BLOOM_H
+#define PROJECT_BASE_BLOOM_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <learnopengl/shader.h>
+#include <rg/GLState.h>
+
+#include <algorithm>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+namespace rg {
+
+    class DualFilterBloom {
+    public:
+        // width/height is the size of the source image, the first level of the chain is half of that
+        void Init(unsigned int width, unsigned int height, unsigned int levels)
+        {
+            downShader.reset(new Shader("resources/shaders/blur.vs", "resources/shaders/bloomDownsample.fs"));
+            upShader.reset(new Shader("resources/shaders/blur.vs", "resources/shaders/bloomUpsample.fs"));
+            downShader->use();
+            downShader->setInt("image", 0);
+            upShader->use();
+            upShader->setInt("image", 0);
+
+            for (unsigned int i = 0; i < levels; i++)
+            {
+                width = std::max(1u, width / 2);
+                height = std::max(1u, height / 2);
+                Level level;
+                level.width = width;
+                level.height = height;
+                glGenTextures(1, &level.texture);
+                glBindTexture(GL_TEXTURE_2D, level.texture);
+                glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, width, height, 0, GL_RGBA, GL_FLOAT, NULL);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+                glGenFramebuffers(1, &level.fbo);
+                glBindFramebuffer(GL_FRAMEBUFFER, level.fbo);
+                glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, level.texture, 0);
+                if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+                    std::cout << "ERROR::BLOOM::FRAMEBUFFER_INCOMPLETE level " << i << std::endl;
+                chain.push_back(level);
+            }
+            glBindTexture(GL_TEXTURE_2D, 0);
+            glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        }
+
+        // blurs source (full resolution) and returns the half resolution texture holding the result.
+        // leaves the viewport at the size of the default framebuffer given here.
+        unsigned int Render(unsigned int source, unsigned int sourceWidth, unsigned int sourceHeight,
+                            unsigned int quadVAO, unsigned int viewportWidth, unsigned int viewportHeight)
+        {
+            GLCache().BindVertexArray(quadVAO);
+
+            // downsample: source -> chain[0] -> chain[1] -> ...
+            downShader->use();
+            unsigned int input = source;
+            glm::vec2 inputSize(sourceWidth, sourceHeight);
+            for (const Level& level : chain)
+            {
+                draw(*downShader, level, input, inputSize);
+                input = level.texture;
+                inputSize = glm::vec2(level.width, level.height);
+            }
+
+            // upsample back up the chain, each level overwrites the (already consumed) downsampled one
+            upShader->use();
+            for (int i = (int)chain.size() - 2; i >= 0; i--)
+            {
+                draw(*upShader, chain[i], chain[i + 1].texture, glm::vec2(chain[i + 1].width, chain[i + 1].height));
+            }
+
+            GLCache().BindFramebuffer(GL_FRAMEBUFFER, 0);
+            glViewport(0, 0, viewportWidth, viewportHeight);
+            return chain.empty() ? source : chain[0].texture;
+        }
+
+    private:
+        struct Level {
+            unsigned int fbo = 0;
+            unsigned int texture = 0;
+            unsigned int width = 0;
+            unsigned int height = 0;
+        };
+        std::vector<Level> chain;
+        std::unique_ptr<Shader> downShader;
+        std::unique_ptr<Shader> upShader;
+
+        void draw(Shader& shader, const Level& target, unsigned int input, glm::vec2 inputSize)
+        {
+            GLCache().BindFramebuffer(GL_FRAMEBUFFER, target.fbo);
+            glViewport(0, 0, target.width, target.height);
+            shader.setVec2("halfPixel"_uniform, 0.5f / inputSize);
+            GLCache().BindTexture(0, GL_TEXTURE_2D, input);
+            glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+        }
+    };
+}
+
+#endif //PROJECT_BASE_BLOOM_H
@@ -0,0 +1,85 @@
+//
+// Per-frame uniform blocks shared by every program (std140 layout).
+//
+
+#ifndef PROJECT_BASE_FRAMEUNIFORMS_H
+#define PROJECT_BASE_FRAMEUNIFORMS_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <learnopengl/shader.h>
+
+#include <cstring>
+#include <vector>
+
+namespace rg {
+
+    // binding points, must match the blocks declared in the shaders
+    const unsigned int CAMERA_BLOCK_BINDING = 0;
+    const unsigned int LIGHTS_BLOCK_BINDING = 1;
+
+    // layout(std140) uniform Camera { mat4 projection; mat4 view; vec4 viewPosition; };
+    struct CameraBlock {
+        glm::mat4 projection;
+        glm::mat4 view;
+        glm::vec4 viewPosition;
+    };
+
+    // layout(std140) uniform Lights { uvec4 clusterDims; vec4 clusterParams; };
+    // the lights themselves live in the buffers of rg::LightClusters, see LightClusters.h
+    struct LightsBlock {
+        glm::uvec4 clusterDims;    // clusters in x, y, z and the number of lights
+        glm::vec4 clusterParams;   // LightClusters::Params()
+    };
+
+    static_assert(sizeof(CameraBlock) == 144, "CameraBlock does not match the std140 layout");
+    static_assert(sizeof(LightsBlock) == 32, "LightsBlock does not match the std140 layout");
+
+    // Both blocks live in one buffer (each at an offset honouring GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT),
+    // so refreshing them costs a single glBufferSubData per frame.
+    class FrameUniforms {
+    public:
+        CameraBlock camera;
+        LightsBlock lights;
+
+        // needs a current GL context
+        void Init()
+        {
+            GLint alignment = 256;
+            glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+            lightsOffset = (sizeof(CameraBlock) + alignment - 1) / alignment * alignment;
+            staging.assign(lightsOffset + sizeof(LightsBlock), 0);
+
+            glGenBuffers(1, &buffer);
+            glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+            glBufferData(GL_UNIFORM_BUFFER, staging.size(), NULL, GL_DYNAMIC_DRAW);
+            glBindBufferRange(GL_UNIFORM_BUFFER, CAMERA_BLOCK_BINDING, buffer, 0, sizeof(CameraBlock));
+            glBindBufferRange(GL_UNIFORM_BUFFER, LIGHTS_BLOCK_BINDING, buffer, lightsOffset, sizeof(LightsBlock));
+            glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        }
+
+        // connects the program's Camera/Lights blocks (if it declares them) to the shared buffer
+        void Attach(const Shader& shader) const
+        {
+            shader.BindUniformBlock("Camera", CAMERA_BLOCK_BINDING);
+            shader.BindUniformBlock("Lights", LIGHTS_BLOCK_BINDING);
+        }
+
+        // uploads camera and lights for the current frame
+        void Upload()
+        {
+            std::memcpy(staging.data(), &camera, sizeof(CameraBlock));
+            std::memcpy(staging.data() + lightsOffset, &lights, sizeof(LightsBlock));
+            glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+            glBufferSubData(GL_UNIFORM_BUFFER, 0, staging.size(), staging.data());
+            glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        }
+
+    private:
+        unsigned int buffer = 0;
+        size_t lightsOffset = 0;
+        std::vector<unsigned char> staging;
+    };
+}
+
+#endif //PROJECT_BASE_FRAMEUNIFORMS_H
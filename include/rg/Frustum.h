@@ -0,0 +1,163 @@
+//
+// View frustum culling: planes extracted from a clip matrix and bounds packed four at a time for SSE tests.
+//
+
+#ifndef PROJECT_BASE_FRUSTUM_H
+#define PROJECT_BASE_FRUSTUM_H
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace rg {
+
+    struct Frustum {
+        // a point p is on the inner side of a plane if dot(plane.xyz, p) + plane.w >= 0
+        glm::vec4 planes[6];
+
+        // Gribb/Hartmann extraction. Given projection * view * model the planes are in the object space of
+        // that model, so object space bounds can be tested directly. Planes are normalized, so distances are
+        // in the units of that space.
+        static Frustum FromMatrix(const glm::mat4& m)
+        {
+            glm::vec4 row0(m[0][0], m[1][0], m[2][0], m[3][0]);
+            glm::vec4 row1(m[0][1], m[1][1], m[2][1], m[3][1]);
+            glm::vec4 row2(m[0][2], m[1][2], m[2][2], m[3][2]);
+            glm::vec4 row3(m[0][3], m[1][3], m[2][3], m[3][3]);
+            Frustum frustum;
+            frustum.planes[0] = row3 + row0; // left
+            frustum.planes[1] = row3 - row0; // right
+            frustum.planes[2] = row3 + row1; // bottom
+            frustum.planes[3] = row3 - row1; // top
+            frustum.planes[4] = row3 + row2; // near
+            frustum.planes[5] = row3 - row2; // far
+            for (glm::vec4& plane : frustum.planes) {
+                float length = glm::length(glm::vec3(plane));
+                if (length > 0.0f)
+                    plane = plane / length;
+            }
+            return frustum;
+        }
+    };
+
+    // Bounds of an object space box and sphere after the affine transform m: the box around the transformed
+    // box (Arvo) and the radius grown by the largest scale of m. Both stay centered on the same point.
+    inline void TransformBounds(const glm::mat4& m, glm::vec3& aabbMin, glm::vec3& aabbMax, float& sphereRadius)
+    {
+        glm::vec3 center = (aabbMin + aabbMax) * 0.5f;
+        glm::vec3 extent = (aabbMax - aabbMin) * 0.5f;
+        glm::vec3 newCenter(m[3]);
+        glm::vec3 newExtent(0.0f);
+        float largestScale = 0.0f;
+        for (int column = 0; column < 3; column++) {
+            glm::vec3 axis(m[column]);
+            newCenter += axis * center[column];
+            newExtent += glm::abs(axis) * extent[column];
+            largestScale = std::max(largestScale, glm::length(axis));
+        }
+        aabbMin = newCenter - newExtent;
+        aabbMax = newCenter + newExtent;
+        sphereRadius *= largestScale;
+    }
+
+    struct CullStats {
+        unsigned int drawn = 0;
+        unsigned int culled = 0;
+    };
+
+    // Box (center/extent) and bounding sphere (around the box center) of many meshes, structure of arrays
+    // padded to a multiple of four so the SSE loop never needs a tail.
+    class PackedBounds {
+    public:
+        void Clear()
+        {
+            count = 0;
+            for (std::vector<float>* column : columns())
+                column->clear();
+        }
+
+        void Add(glm::vec3 aabbMin, glm::vec3 aabbMax, float sphereRadius)
+        {
+            if (count % 4 == 0) {
+                // open a new group of four, the unused lanes are tested but never reported
+                for (std::vector<float>* column : columns())
+                    column->resize(count + 4, 0.0f);
+            }
+            glm::vec3 center = (aabbMin + aabbMax) * 0.5f;
+            glm::vec3 extent = (aabbMax - aabbMin) * 0.5f;
+            centerX[count] = center.x;
+            centerY[count] = center.y;
+            centerZ[count] = center.z;
+            extentX[count] = extent.x;
+            extentY[count] = extent.y;
+            extentZ[count] = extent.z;
+            radius[count] = sphereRadius;
+            count++;
+        }
+
+        size_t Size() const { return count; }
+
+        // visible[i] is set to 1 for every entry that intersects the frustum (given in the same space as the
+        // bounds) and 0 for the rest. An entry is culled if its sphere or its box lies behind any plane.
+        unsigned int Cull(const Frustum& frustum, std::vector<unsigned char>& visible) const
+        {
+            visible.resize(count);
+            unsigned int visibleCount = 0;
+#if defined(__SSE2__)
+            for (size_t i = 0; i < count; i += 4) {
+                const __m128 cx = _mm_loadu_ps(&centerX[i]), cy = _mm_loadu_ps(&centerY[i]), cz = _mm_loadu_ps(&centerZ[i]);
+                const __m128 ex = _mm_loadu_ps(&extentX[i]), ey = _mm_loadu_ps(&extentY[i]), ez = _mm_loadu_ps(&extentZ[i]);
+                const __m128 r = _mm_loadu_ps(&radius[i]);
+                __m128 outside = _mm_setzero_ps();
+                for (const glm::vec4& plane : frustum.planes) {
+                    __m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(plane.x), cx), _mm_mul_ps(_mm_set1_ps(plane.y), cy)),
+                                          _mm_add_ps(_mm_mul_ps(_mm_set1_ps(plane.z), cz), _mm_set1_ps(plane.w)));
+                    // projected half size of the box onto the plane normal
+                    __m128 e = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(std::fabs(plane.x)), ex),
+                                                     _mm_mul_ps(_mm_set1_ps(std::fabs(plane.y)), ey)),
+                                          _mm_mul_ps(_mm_set1_ps(std::fabs(plane.z)), ez));
+                    __m128 zero = _mm_setzero_ps();
+                    outside = _mm_or_ps(outside, _mm_cmplt_ps(_mm_add_ps(d, e), zero));
+                    outside = _mm_or_ps(outside, _mm_cmplt_ps(_mm_add_ps(d, r), zero));
+                }
+                int mask = _mm_movemask_ps(outside);
+                for (size_t lane = 0; lane < 4 && i + lane < count; lane++) {
+                    visible[i + lane] = (mask >> lane & 1) ? 0 : 1;
+                    visibleCount += visible[i + lane];
+                }
+            }
+#else
+            for (size_t i = 0; i < count; i++) {
+                bool outside = false;
+                for (const glm::vec4& plane : frustum.planes) {
+                    float d = plane.x * centerX[i] + plane.y * centerY[i] + plane.z * centerZ[i] + plane.w;
+                    float e = std::fabs(plane.x) * extentX[i] + std::fabs(plane.y) * extentY[i] + std::fabs(plane.z) * extentZ[i];
+                    outside = outside || d + e < 0.0f || d + radius[i] < 0.0f;
+                }
+                visible[i] = outside ? 0 : 1;
+                visibleCount += visible[i];
+            }
+#endif
+            return visibleCount;
+        }
+
+    private:
+        size_t count = 0;
+        std::vector<float> centerX, centerY, centerZ;
+        std::vector<float> extentX, extentY, extentZ;
+        std::vector<float> radius;
+
+        std::vector<std::vector<float>*> columns()
+        {
+            return {&centerX, &centerY, &centerZ, &extentX, &extentY, &extentZ, &radius};
+        }
+    };
+}
+
+#endif //PROJECT_BASE_FRUSTUM_H
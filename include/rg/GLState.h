@@ -0,0 +1,170 @@
+//
+// Shadow copy of the GL binding state touched every frame (program, VAO, textures per unit, framebuffers,
+// capabilities), so calls that would not change anything are skipped. Code that binds through GL directly
+// (resource creation, ImGui) must call Invalidate afterwards.
+//
+
+#ifndef PROJECT_BASE_GLSTATE_H
+#define PROJECT_BASE_GLSTATE_H
+
+#include <glad/glad.h>
+
+#include <utility>
+#include <vector>
+
+namespace rg {
+
+    struct GLStateStats {
+        unsigned int issued = 0;
+        unsigned int skipped = 0;
+    };
+
+    class GLStateCache {
+    public:
+        GLStateCache() { Invalidate(); }
+
+        void UseProgram(unsigned int program)
+        {
+            if (update(this->program, program))
+                glUseProgram(program);
+        }
+
+        void BindVertexArray(unsigned int vao)
+        {
+            if (update(vertexArray, vao))
+                glBindVertexArray(vao);
+        }
+
+        // selects the unit only when the binding actually changes
+        void BindTexture(unsigned int unit, GLenum target, unsigned int texture)
+        {
+            int targetIndex = textureTargetIndex(target);
+            if (unit >= MAX_UNITS || targetIndex < 0) {
+                ActiveTexture(unit);
+                glBindTexture(target, texture);
+                stats.issued++;
+                return;
+            }
+            if (!update(textures[unit][targetIndex], texture))
+                return;
+            ActiveTexture(unit);
+            glBindTexture(target, texture);
+        }
+
+        void ActiveTexture(unsigned int unit)
+        {
+            if (update(activeUnit, unit))
+                glActiveTexture(GL_TEXTURE0 + unit);
+        }
+
+        // GL_FRAMEBUFFER sets both the draw and the read binding
+        void BindFramebuffer(GLenum target, unsigned int framebuffer)
+        {
+            bool draw = target != GL_READ_FRAMEBUFFER;
+            bool read = target != GL_DRAW_FRAMEBUFFER;
+            if ((!draw || drawFramebuffer == (long long)framebuffer) && (!read || readFramebuffer == (long long)framebuffer)) {
+                stats.skipped++;
+                return;
+            }
+            if (draw)
+                drawFramebuffer = framebuffer;
+            if (read)
+                readFramebuffer = framebuffer;
+            glBindFramebuffer(target, framebuffer);
+            stats.issued++;
+        }
+
+        void Enable(GLenum capability) { setCapability(capability, true); }
+        void Disable(GLenum capability) { setCapability(capability, false); }
+
+        // forget everything, the next call of each kind goes to GL
+        void Invalidate()
+        {
+            program = vertexArray = activeUnit = UNKNOWN;
+            drawFramebuffer = readFramebuffer = UNKNOWN;
+            for (auto& unit : textures)
+                for (long long& texture : unit)
+                    texture = UNKNOWN;
+            capabilities.clear();
+        }
+
+        // counters since the last call
+        GLStateStats TakeStats()
+        {
+            GLStateStats taken = stats;
+            stats = GLStateStats();
+            return taken;
+        }
+
+    private:
+        static const long long UNKNOWN = -1;
+        static const unsigned int MAX_UNITS = 16;
+
+        // the texture targets used by the renderer
+        static int textureTargetIndex(GLenum target)
+        {
+            switch (target) {
+                case GL_TEXTURE_2D: return 0;
+                case GL_TEXTURE_2D_ARRAY: return 1;
+                case GL_TEXTURE_BUFFER: return 2;
+                default: return -1;
+            }
+        }
+
+        long long program = UNKNOWN;
+        long long vertexArray = UNKNOWN;
+        long long activeUnit = UNKNOWN;
+        long long drawFramebuffer = UNKNOWN;
+        long long readFramebuffer = UNKNOWN;
+        long long textures[MAX_UNITS][3] = {};
+        std::vector<std::pair<GLenum, bool>> capabilities;
+        GLStateStats stats;
+
+        // records value and returns true if it differs from the shadowed one
+        bool update(long long& shadow, unsigned int value)
+        {
+            if (shadow == (long long)value) {
+                stats.skipped++;
+                return false;
+            }
+            shadow = value;
+            stats.issued++;
+            return true;
+        }
+
+        void setCapability(GLenum capability, bool enabled)
+        {
+            for (std::pair<GLenum, bool>& known : capabilities) {
+                if (known.first != capability)
+                    continue;
+                if (known.second == enabled) {
+                    stats.skipped++;
+                    return;
+                }
+                known.second = enabled;
+                apply(capability, enabled);
+                return;
+            }
+            capabilities.push_back(std::make_pair(capability, enabled));
+            apply(capability, enabled);
+        }
+
+        void apply(GLenum capability, bool enabled)
+        {
+            if (enabled)
+                glEnable(capability);
+            else
+                glDisable(capability);
+            stats.issued++;
+        }
+    };
+
+    // the cache of the one GL context the application uses
+    inline GLStateCache& GLCache()
+    {
+        static GLStateCache cache;
+        return cache;
+    }
+}
+
+#endif //PROJECT_BASE_GLSTATE_H
@@ -0,0 +1,205 @@
+//
+// Shared geometry buffers: one vertex buffer, one index buffer and one VAO per vertex format, sub-allocated
+// by every mesh of that format, so a whole model is drawn without switching buffers.
+//
+
+#ifndef PROJECT_BASE_GEOMETRYARENA_H
+#define PROJECT_BASE_GEOMETRYARENA_H
+
+#include <glad/glad.h>
+#include <rg/VertexPacking.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <map>
+
+namespace rg {
+
+    // First fit allocator over an abstract range of units, neighbouring free blocks are merged on Free.
+    class OffsetAllocator {
+    public:
+        static const uint64_t INVALID = ~uint64_t(0);
+
+        explicit OffsetAllocator(uint64_t capacity = 0) { Grow(capacity); }
+
+        uint64_t Capacity() const { return capacity; }
+        uint64_t Used() const { return used; }
+
+        // returns the offset of the block or INVALID if no free block is large enough
+        uint64_t Allocate(uint64_t size, uint64_t alignment = 1)
+        {
+            for (auto it = freeBlocks.begin(); it != freeBlocks.end(); ++it) {
+                uint64_t offset = (it->first + alignment - 1) / alignment * alignment;
+                uint64_t end = it->first + it->second;
+                if (offset + size > end)
+                    continue;
+                uint64_t blockStart = it->first;
+                freeBlocks.erase(it);
+                // give back the padding in front and whatever is left behind the allocation
+                if (offset > blockStart)
+                    freeBlocks[blockStart] = offset - blockStart;
+                if (offset + size < end)
+                    freeBlocks[offset + size] = end - offset - size;
+                used += size;
+                return offset;
+            }
+            return INVALID;
+        }
+
+        void Free(uint64_t offset, uint64_t size)
+        {
+            used -= size;
+            auto next = freeBlocks.lower_bound(offset);
+            if (next != freeBlocks.end() && offset + size == next->first) {
+                size += next->second;
+                next = freeBlocks.erase(next);
+            }
+            if (next != freeBlocks.begin()) {
+                auto previous = std::prev(next);
+                if (previous->first + previous->second == offset) {
+                    previous->second += size;
+                    return;
+                }
+            }
+            freeBlocks[offset] = size;
+        }
+
+        // extends the range at its end
+        void Grow(uint64_t newCapacity)
+        {
+            if (newCapacity <= capacity)
+                return;
+            uint64_t added = newCapacity - capacity;
+            uint64_t oldCapacity = capacity;
+            capacity = newCapacity;
+            used += added; // Free below takes it off again
+            Free(oldCapacity, added);
+        }
+
+    private:
+        uint64_t capacity = 0;
+        uint64_t used = 0;
+        std::map<uint64_t, uint64_t> freeBlocks; // offset -> size
+    };
+
+    struct GeometryAllocation {
+        uint64_t firstVertex = 0;   // in vertices of the arena's format
+        uint64_t vertexCount = 0;
+        uint64_t indexOffset = 0;   // in bytes, aligned to 4 so 16 and 32-bit indices can share the buffer
+        uint64_t indexBytes = 0;
+    };
+
+    class GeometryArena {
+    public:
+        // describes the vertex attributes of the bound GL_ARRAY_BUFFER, called again whenever it is replaced
+        typedef std::function<void()> AttributeSetup;
+
+        GeometryArena(size_t vertexStride, AttributeSetup setupAttributes)
+                : vertexStride(vertexStride), setupAttributes(setupAttributes) {}
+
+        unsigned int VAO() const { return vao; }
+        unsigned int VertexBuffer() const { return vertexBuffer; }
+        unsigned int IndexBuffer() const { return indexBuffer; }
+        size_t VertexStride() const { return vertexStride; }
+
+        // copies the data into the shared buffers, growing them when they are full. Needs a current GL context.
+        GeometryAllocation Allocate(const void* vertexData, size_t vertexCount, const void* indexData, size_t indexBytes)
+        {
+            if (vao == 0)
+                create();
+            GeometryAllocation allocation;
+            allocation.vertexCount = vertexCount;
+            allocation.indexBytes = indexBytes;
+            allocation.firstVertex = allocateWithGrowth(vertexAllocator, vertexCount, 1, vertexBuffer,
+                                                        GL_ARRAY_BUFFER, vertexStride);
+            allocation.indexOffset = allocateWithGrowth(indexAllocator, indexBytes, 4, indexBuffer,
+                                                        GL_ELEMENT_ARRAY_BUFFER, 1);
+
+            glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+            glBufferSubData(GL_ARRAY_BUFFER, allocation.firstVertex * vertexStride, vertexCount * vertexStride, vertexData);
+            glBindBuffer(GL_ARRAY_BUFFER, 0);
+            // GL_ELEMENT_ARRAY_BUFFER is VAO state, go through GL_COPY_WRITE_BUFFER to leave every VAO alone
+            glBindBuffer(GL_COPY_WRITE_BUFFER, indexBuffer);
+            glBufferSubData(GL_COPY_WRITE_BUFFER, allocation.indexOffset, indexBytes, indexData);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+            return allocation;
+        }
+
+        // the space is reused by later allocations, the buffers never shrink
+        void Free(const GeometryAllocation& allocation)
+        {
+            vertexAllocator.Free(allocation.firstVertex, allocation.vertexCount);
+            indexAllocator.Free(allocation.indexOffset, allocation.indexBytes);
+        }
+
+        size_t VertexBytesUsed() const { return vertexAllocator.Used() * vertexStride; }
+        size_t IndexBytesUsed() const { return indexAllocator.Used(); }
+
+    private:
+        static const uint64_t INITIAL_VERTEX_BYTES = 4 << 20;
+        static const uint64_t INITIAL_INDEX_BYTES = 2 << 20;
+
+        size_t vertexStride;
+        AttributeSetup setupAttributes;
+        unsigned int vao = 0;
+        unsigned int vertexBuffer = 0;
+        unsigned int indexBuffer = 0;
+        OffsetAllocator vertexAllocator;
+        OffsetAllocator indexAllocator;
+
+        void create()
+        {
+            vertexAllocator.Grow(INITIAL_VERTEX_BYTES / vertexStride);
+            indexAllocator.Grow(INITIAL_INDEX_BYTES);
+            glGenVertexArrays(1, &vao);
+            glGenBuffers(1, &vertexBuffer);
+            glGenBuffers(1, &indexBuffer);
+            glBindVertexArray(vao);
+            glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+            glBufferData(GL_ARRAY_BUFFER, vertexAllocator.Capacity() * vertexStride, NULL, GL_STATIC_DRAW);
+            setupAttributes();
+            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
+            glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexAllocator.Capacity(), NULL, GL_STATIC_DRAW);
+            glBindVertexArray(0);
+            glBindBuffer(GL_ARRAY_BUFFER, 0);
+        }
+
+        // allocates, doubling the buffer (and copying its contents over) until the request fits
+        uint64_t allocateWithGrowth(OffsetAllocator& allocator, uint64_t size, uint64_t alignment,
+                                    unsigned int& buffer, GLenum target, size_t unitBytes)
+        {
+            uint64_t offset = allocator.Allocate(size, alignment);
+            while (offset == OffsetAllocator::INVALID) {
+                uint64_t oldCapacity = allocator.Capacity();
+                allocator.Grow(std::max(oldCapacity * 2, oldCapacity + size + alignment));
+                unsigned int grown;
+                glGenBuffers(1, &grown);
+                glBindBuffer(GL_COPY_WRITE_BUFFER, grown);
+                glBufferData(GL_COPY_WRITE_BUFFER, allocator.Capacity() * unitBytes, NULL, GL_STATIC_DRAW);
+                glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+                glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, oldCapacity * unitBytes);
+                glBindBuffer(GL_COPY_READ_BUFFER, 0);
+                glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+                glDeleteBuffers(1, &buffer);
+                buffer = grown;
+
+                // point the VAO at the new buffer, offsets inside it did not change
+                glBindVertexArray(vao);
+                if (target == GL_ARRAY_BUFFER) {
+                    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+                    setupAttributes();
+                    glBindBuffer(GL_ARRAY_BUFFER, 0);
+                } else {
+                    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffer);
+                }
+                glBindVertexArray(0);
+                offset = allocator.Allocate(size, alignment);
+            }
+            return offset;
+        }
+    };
+}
+
+#endif //PROJECT_BASE_GEOMETRYARENA_H
@@ -0,0 +1,40 @@
+//
+// Content hashes used to tell whether a cached file still matches its source.
+//
+
+#ifndef PROJECT_BASE_HASH_H
+#define PROJECT_BASE_HASH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace rg {
+
+    // 64-bit FNV-1a, good enough to notice that a source file changed
+    inline uint64_t HashBytes(const void* data, size_t size, uint64_t hash = 14695981039346656037ull) {
+        const unsigned char* bytes = static_cast<const unsigned char*>(data);
+        for (size_t i = 0; i < size; ++i) {
+            hash ^= bytes[i];
+            hash *= 1099511628211ull;
+        }
+        return hash;
+    }
+
+    inline bool HashFile(const std::string& path, uint64_t& hash) {
+        std::ifstream in(path, std::ios::binary);
+        if (!in)
+            return false;
+        std::vector<char> buffer(1 << 16);
+        hash = 14695981039346656037ull;
+        while (in) {
+            in.read(buffer.data(), buffer.size());
+            hash = HashBytes(buffer.data(), (size_t)in.gcount(), hash);
+        }
+        return true;
+    }
+}
+
+#endif //PROJECT_BASE_HASH_H
@@ -0,0 +1,417 @@
+//
+// Indirect submission of a model's meshes: one DrawElementsIndirectCommand per index range, instanced once per
+// copy of the mesh (per run of visible sub meshes for a static batch), and a single glMultiDrawElementsIndirect
+// per index type. The shader fetches the per-draw data
+// (position dequantization, instance transform, material index, texture coordinate set) through an instanced draw
+// id attribute selected by baseInstance, and the material's texture array layers from the material buffer.
+//
+
+#ifndef PROJECT_BASE_INDIRECTDRAW_H
+#define PROJECT_BASE_INDIRECTDRAW_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <learnopengl/mesh.h>
+#include <rg/GLState.h>
+
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <string>
+#include <tuple>
+#include <vector>
+
+namespace rg {
+
+    // GL 4.3 / ARB_multi_draw_indirect, not part of the GL 3.3 glad loader
+    const GLenum DRAW_INDIRECT_BUFFER = 0x8F3F;
+    typedef void (APIENTRYP MultiDrawElementsIndirectProc)(GLenum mode, GLenum type, const void* indirect,
+                                                          GLsizei drawCount, GLsizei stride);
+
+    // texture units of the per-draw and per-material buffers, below the light cluster units
+    const unsigned int INSTANCE_TEXCOORD_TEXTURE_UNIT = 9;
+    const unsigned int MATERIAL_DATA_TEXTURE_UNIT = 10;
+    const unsigned int DRAW_DATA_TEXTURE_UNIT = 11;
+    // instanced uint attribute holding the draw index, after the attributes of every vertex format
+    const unsigned int DRAW_ID_ATTRIBUTE = 5;
+
+    inline MultiDrawElementsIndirectProc& MultiDrawElementsIndirectFunction()
+    {
+        static MultiDrawElementsIndirectProc function = nullptr;
+        return function;
+    }
+
+    // Loads glMultiDrawElementsIndirect if the context is 4.3+ or has ARB_multi_draw_indirect, and honours the
+    // baseInstance of a command (4.2+ or ARB_base_instance), which offsets the per-command draw id attribute.
+    // Call after gladLoadGLLoader with the same loader; returns false on plain GL 3.3 contexts, whose draws then
+    // offset the attribute pointer instead.
+    inline bool LoadMultiDrawIndirect(GLADloadproc load)
+    {
+        GLint major = 0, minor = 0;
+        glGetIntegerv(GL_MAJOR_VERSION, &major);
+        glGetIntegerv(GL_MINOR_VERSION, &minor);
+        bool multiDraw = major > 4 || (major == 4 && minor >= 3);
+        bool baseInstance = major > 4 || (major == 4 && minor >= 2);
+        GLint extensionCount = 0;
+        if (!multiDraw || !baseInstance)
+            glGetIntegerv(GL_NUM_EXTENSIONS, &extensionCount);
+        for (GLint i = 0; i < extensionCount && !(multiDraw && baseInstance); i++) {
+            const char* extension = (const char*)glGetStringi(GL_EXTENSIONS, i);
+            if (!extension)
+                continue;
+            multiDraw = multiDraw || std::strcmp(extension, "GL_ARB_multi_draw_indirect") == 0;
+            baseInstance = baseInstance || std::strcmp(extension, "GL_ARB_base_instance") == 0;
+        }
+        MultiDrawElementsIndirectFunction() =
+                multiDraw && baseInstance ? (MultiDrawElementsIndirectProc)load("glMultiDrawElementsIndirect") : nullptr;
+        return MultiDrawElementsIndirectFunction() != nullptr;
+    }
+
+    inline bool MultiDrawIndirectSupported()
+    {
+        return MultiDrawElementsIndirectFunction() != nullptr;
+    }
+
+    // layout fixed by GL
+    struct DrawElementsIndirectCommand {
+        GLuint count;
+        GLuint instanceCount;
+        GLuint firstIndex;
+        GLint baseVertex;
+        GLuint baseInstance;
+    };
+
+    static_assert(sizeof(DrawElementsIndirectCommand) == 20, "DrawElementsIndirectCommand must match the GL layout");
+
+    // Per instance, six RGBA32F texels of the draw data buffer: dequantization and material, the rows of the
+    // instance's model space transform, and where its own texture coordinates start in the instance texture
+    // coordinate buffer, relative to gl_VertexID (used if hasTexCoords is set).
+    struct GpuDrawData {
+        glm::vec3 positionOffset;
+        float materialIndex;
+        glm::vec3 positionScale;
+        float packedNormals;
+        glm::vec4 transformRows[3];
+        float texCoordBase;
+        float hasTexCoords;
+        float padding[2];
+    };
+
+    // Per distinct texture set, two RGBA32F texels of the material buffer: texture array (unit) and layer of the
+    // diffuse and the specular map, then the colors the shader uses where the array is -1 (the map is missing,
+    // zero, or a single color image, its color).
+    struct GpuMaterial {
+        float diffuseArray;
+        float diffuseLayer;
+        float specularArray;
+        float specularLayer;
+        glm::vec3 diffuseColor;
+        float specularColor;
+    };
+
+    static_assert(sizeof(GpuDrawData) == 96, "GpuDrawData must be exactly six vec4s");
+    static_assert(sizeof(GpuMaterial) == 32, "GpuMaterial must be exactly two vec4s");
+
+    struct IndirectDrawStats {
+        unsigned int drawCalls = 0;  // GL draw calls issued, multi draws count once
+        unsigned int commands = 0;   // index ranges drawn, once per instance
+    };
+
+    class IndirectDrawList {
+    public:
+        // Builds the per-draw data of the meshes (all in the same geometry arena) and the material table. Every
+        // MeshInstance is drawn as one instance; instances are numbered mesh by mesh. Culling works on objects,
+        // numbered the same way except that a static batch has one object per sub mesh instead of its instance.
+        // Needs the final texture array layers, so call after the textures are uploaded.
+        void Build(const std::vector<Mesh>& meshes)
+        {
+            if (drawDataTexture == 0)
+                create();
+
+            std::map<std::tuple<int, int, int, int, float, float, float, float>, unsigned int> materialIndices;
+            std::vector<GpuMaterial> materials;
+            std::vector<GpuDrawData> drawData;
+            std::vector<glm::vec2> texCoords;
+            meshDraws.resize(meshes.size());
+            objectCount = 0;
+            for (size_t i = 0; i < meshes.size(); i++) {
+                const Mesh& mesh = meshes[i];
+                // the shader only samples the first diffuse and the first specular map
+                const Texture* diffuse = findTexture(mesh, "texture_diffuse");
+                const Texture* specular = findTexture(mesh, "texture_specular");
+                glm::vec4 diffuseColor = diffuse ? diffuse->color : glm::vec4(0.0f);
+                float specularColor = specular ? specular->color.x : 0.0f;
+                std::tuple<int, int, int, int, float, float, float, float> key(
+                        diffuse ? diffuse->array : -1, diffuse ? diffuse->layer : 0,
+                        specular ? specular->array : -1, specular ? specular->layer : 0,
+                        diffuseColor.r, diffuseColor.g, diffuseColor.b, specularColor);
+                auto inserted = materialIndices.insert(std::make_pair(key, (unsigned int)materials.size()));
+                if (inserted.second)
+                    materials.push_back(GpuMaterial{(float)std::get<0>(key), (float)std::get<1>(key),
+                                                    (float)std::get<2>(key), (float)std::get<3>(key),
+                                                    glm::vec3(diffuseColor), specularColor});
+                MeshDraw& draw = meshDraws[i];
+                draw.indexType = mesh.indexType;
+                draw.ranges = mesh.indexRanges;
+                draw.firstInstance = (unsigned int)drawData.size();
+                draw.instanceCount = (unsigned int)mesh.instances.size();
+                draw.firstObject = objectCount;
+                // sub mesh runs absolute in the index buffer like the ranges
+                size_t indexSize = mesh.indexType == GL_UNSIGNED_SHORT ? sizeof(uint16_t) : sizeof(unsigned int);
+                draw.subMeshes.clear();
+                for (const SubMesh& subMesh : mesh.subMeshes)
+                    draw.subMeshes.push_back(IndexRun{subMesh.firstIndex + (unsigned int)(mesh.allocation.indexOffset / indexSize),
+                                                      subMesh.indexCount});
+                objectCount += draw.subMeshes.empty() ? draw.instanceCount : (unsigned int)draw.subMeshes.size();
+                // gl_VertexID counts from the start of the arena, the sets of the mesh from texCoordStart
+                float texCoordStart = (float)texCoords.size() - (float)mesh.allocation.firstVertex;
+                texCoords.insert(texCoords.end(), mesh.instanceTexCoords.begin(), mesh.instanceTexCoords.end());
+                for (const MeshInstance& instance : mesh.instances) {
+                    GpuDrawData data;
+                    data.positionOffset = mesh.positionOffset;
+                    data.materialIndex = (float)inserted.first->second;
+                    data.positionScale = mesh.positionScale;
+                    data.packedNormals = mesh.vertexFormat != VertexFormat::Full ? 1.0f : 0.0f;
+                    for (int row = 0; row < 3; row++)
+                        data.transformRows[row] = glm::vec4(instance.transform[0][row], instance.transform[1][row],
+                                                            instance.transform[2][row], instance.transform[3][row]);
+                    data.texCoordBase = texCoordStart + (float)std::max(instance.texCoordSet, 0) * (float)mesh.vertices.size();
+                    data.hasTexCoords = instance.texCoordSet >= 0 ? 1.0f : 0.0f;
+                    data.padding[0] = data.padding[1] = 0.0f;
+                    drawData.push_back(data);
+                }
+            }
+
+            order.resize(meshes.size());
+            for (size_t i = 0; i < order.size(); i++)
+                order[i] = (unsigned int)i;
+            std::stable_sort(order.begin(), order.end(), [&](unsigned int a, unsigned int b) {
+                return meshes[a].indexType < meshes[b].indexType;
+            });
+
+            drawIds.resize(drawData.size());
+            for (size_t i = 0; i < drawIds.size(); i++)
+                drawIds[i] = (unsigned int)i;
+            visibleInstances.resize(meshes.size());
+            for (size_t i = 0; i < meshes.size(); i++)
+                visibleInstances[i] = meshDraws[i].instanceCount;
+            buildCommands(nullptr);
+            commands.swap(pendingCommands);
+            upload(GL_ARRAY_BUFFER, drawIdBuffer, drawIds.size() * sizeof(unsigned int), drawIds.data(), GL_STREAM_DRAW);
+            upload(GL_TEXTURE_BUFFER, drawDataBuffer, drawData.size() * sizeof(GpuDrawData), drawData.data(), GL_STATIC_DRAW);
+            upload(GL_TEXTURE_BUFFER, materialBuffer, materials.size() * sizeof(GpuMaterial), materials.data(), GL_STATIC_DRAW);
+            upload(GL_TEXTURE_BUFFER, texCoordBuffer, texCoords.size() * sizeof(glm::vec2), texCoords.data(), GL_STATIC_DRAW);
+            commandsChanged = true;
+        }
+
+        size_t CommandCount() const { return commands.size(); }
+        size_t InstanceCount() const { return drawIds.size(); }
+        size_t ObjectCount() const { return objectCount; }
+
+        // Draws the objects with visible[object] set (all of them if visible is null); the arena VAO of the
+        // meshes and the model's texture arrays must be bound. Falls back to one glDrawElementsInstancedBaseVertex
+        // per command without multi draw indirect.
+        void Draw(const std::vector<unsigned char>* visible, bool multiDraw, IndirectDrawStats& stats)
+        {
+            GLCache().BindTexture(DRAW_DATA_TEXTURE_UNIT, GL_TEXTURE_BUFFER, drawDataTexture);
+            GLCache().BindTexture(MATERIAL_DATA_TEXTURE_UNIT, GL_TEXTURE_BUFFER, materialTexture);
+            GLCache().BindTexture(INSTANCE_TEXCOORD_TEXTURE_UNIT, GL_TEXTURE_BUFFER, texCoordTexture);
+
+            // the visible instances of a mesh are packed to the front of its block of draw ids, so baseInstance
+            // stays put and only the instance counts change; a static batch keeps its one instance and culls
+            // through the index runs it draws instead
+            bool drawIdsChanged = false;
+            for (size_t mesh = 0; mesh < meshDraws.size(); mesh++) {
+                const MeshDraw& draw = meshDraws[mesh];
+                if (!draw.subMeshes.empty())
+                    continue;
+                unsigned int first = draw.firstInstance, count = 0;
+                for (unsigned int instance = 0; instance < draw.instanceCount; instance++) {
+                    if (visible && !(*visible)[draw.firstObject + instance])
+                        continue;
+                    drawIdsChanged = drawIdsChanged || drawIds[first + count] != first + instance;
+                    drawIds[first + count++] = first + instance;
+                }
+                visibleInstances[mesh] = count;
+            }
+            if (drawIdsChanged)
+                upload(GL_ARRAY_BUFFER, drawIdBuffer, drawIds.size() * sizeof(unsigned int), drawIds.data(), GL_STREAM_DRAW);
+            buildCommands(visible);
+            if (pendingCommands.size() != commands.size()
+                || std::memcmp(pendingCommands.data(), commands.data(), commands.size() * sizeof(DrawElementsIndirectCommand)) != 0) {
+                commands.swap(pendingCommands);
+                commandsChanged = true;
+            }
+
+            if (multiDraw && MultiDrawIndirectSupported()) {
+                if (commandsChanged)
+                    upload(DRAW_INDIRECT_BUFFER, commandBuffer, commands.size() * sizeof(DrawElementsIndirectCommand),
+                           commands.data(), GL_STREAM_DRAW);
+                commandsChanged = false;
+                glBindBuffer(DRAW_INDIRECT_BUFFER, commandBuffer);
+                // instance i of a command reads element baseInstance + i
+                glBindBuffer(GL_ARRAY_BUFFER, drawIdBuffer);
+                glEnableVertexAttribArray(DRAW_ID_ATTRIBUTE);
+                glVertexAttribIPointer(DRAW_ID_ATTRIBUTE, 1, GL_UNSIGNED_INT, sizeof(unsigned int), (void*)0);
+                glVertexAttribDivisor(DRAW_ID_ATTRIBUTE, 1);
+                glBindBuffer(GL_ARRAY_BUFFER, 0);
+                for (const Batch& batch : batches) {
+                    if (batch.commandCount == 0)
+                        continue;
+                    MultiDrawElementsIndirectFunction()(GL_TRIANGLES, batch.indexType,
+                                                        (void*)(batch.firstCommand * sizeof(DrawElementsIndirectCommand)),
+                                                        (GLsizei)batch.commandCount, 0);
+                    stats.drawCalls++;
+                }
+                glDisableVertexAttribArray(DRAW_ID_ATTRIBUTE);
+                glBindBuffer(DRAW_INDIRECT_BUFFER, 0);
+            } else {
+                glBindBuffer(GL_ARRAY_BUFFER, drawIdBuffer);
+                glEnableVertexAttribArray(DRAW_ID_ATTRIBUTE);
+                glVertexAttribDivisor(DRAW_ID_ATTRIBUTE, 1);
+                for (const Batch& batch : batches) {
+                    if (batch.commandCount == 0)
+                        continue;
+                    size_t indexSize = batch.indexType == GL_UNSIGNED_SHORT ? sizeof(uint16_t) : sizeof(unsigned int);
+                    for (size_t c = batch.firstCommand; c < batch.firstCommand + batch.commandCount; c++) {
+                        const DrawElementsIndirectCommand& command = commands[c];
+                        // no baseInstance before GL 4.2, the attribute starts at the command's draw ids instead
+                        glVertexAttribIPointer(DRAW_ID_ATTRIBUTE, 1, GL_UNSIGNED_INT, sizeof(unsigned int),
+                                               (void*)(command.baseInstance * sizeof(unsigned int)));
+                        glDrawElementsInstancedBaseVertex(GL_TRIANGLES, command.count, batch.indexType,
+                                                          (void*)(command.firstIndex * indexSize),
+                                                          command.instanceCount, command.baseVertex);
+                        stats.drawCalls++;
+                    }
+                }
+                glDisableVertexAttribArray(DRAW_ID_ATTRIBUTE);
+                glBindBuffer(GL_ARRAY_BUFFER, 0);
+            }
+            for (const DrawElementsIndirectCommand& command : commands)
+                stats.commands += command.instanceCount;
+        }
+
+    private:
+        // consecutive commands sharing the index type, drawn by one multi draw
+        struct Batch {
+            GLenum indexType;
+            size_t firstCommand;
+            size_t commandCount;
+        };
+
+        // run of the index buffer in indices of the mesh's index type
+        struct IndexRun {
+            unsigned int firstIndex;
+            unsigned int count;
+        };
+
+        // per mesh: its index ranges, its block of instances and of culled objects, and the sub meshes of a batch
+        struct MeshDraw {
+            GLenum indexType;
+            std::vector<IndexRange> ranges;
+            unsigned int firstInstance;
+            unsigned int instanceCount;
+            unsigned int firstObject;
+            std::vector<IndexRun> subMeshes;
+        };
+
+        // commands of the visible objects only, grouped by index type; pendingCommands is the next frame's set
+        std::vector<DrawElementsIndirectCommand> commands, pendingCommands;
+        std::vector<MeshDraw> meshDraws;
+        // meshes sorted by index type
+        std::vector<unsigned int> order;
+        // per mesh, how many of its instances passed culling this frame
+        std::vector<unsigned int> visibleInstances;
+        unsigned int objectCount = 0;
+        // contents of the draw id buffer, the visible instances of each mesh first
+        std::vector<unsigned int> drawIds;
+        std::vector<Batch> batches;
+        // the command buffer is only uploaded again when the visible set changed
+        bool commandsChanged = true;
+        unsigned int commandBuffer = 0, drawIdBuffer = 0;
+        unsigned int drawDataBuffer = 0, drawDataTexture = 0;
+        unsigned int materialBuffer = 0, materialTexture = 0;
+        unsigned int texCoordBuffer = 0, texCoordTexture = 0;
+
+        void create()
+        {
+            glGenBuffers(1, &commandBuffer);
+            glGenBuffers(1, &drawIdBuffer);
+            glGenBuffers(1, &drawDataBuffer);
+            glGenBuffers(1, &materialBuffer);
+            glGenBuffers(1, &texCoordBuffer);
+            glGenTextures(1, &drawDataTexture);
+            glGenTextures(1, &materialTexture);
+            glGenTextures(1, &texCoordTexture);
+            // texture buffers need storage before they are attached
+            upload(GL_TEXTURE_BUFFER, drawDataBuffer, 16, nullptr, GL_STATIC_DRAW);
+            upload(GL_TEXTURE_BUFFER, materialBuffer, 16, nullptr, GL_STATIC_DRAW);
+            upload(GL_TEXTURE_BUFFER, texCoordBuffer, 16, nullptr, GL_STATIC_DRAW);
+            glBindTexture(GL_TEXTURE_BUFFER, drawDataTexture);
+            glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, drawDataBuffer);
+            glBindTexture(GL_TEXTURE_BUFFER, materialTexture);
+            glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, materialBuffer);
+            glBindTexture(GL_TEXTURE_BUFFER, texCoordTexture);
+            glTexBuffer(GL_TEXTURE_BUFFER, GL_RG32F, texCoordBuffer);
+            glBindTexture(GL_TEXTURE_BUFFER, 0);
+        }
+
+        static void upload(GLenum target, unsigned int buffer, size_t size, const void* data, GLenum usage)
+        {
+            glBindBuffer(target, buffer);
+            glBufferData(target, std::max<size_t>(size, 16), NULL, usage); // orphan the previous storage
+            if (data && size > 0)
+                glBufferSubData(target, 0, size, data);
+            glBindBuffer(target, 0);
+        }
+
+        static const Texture* findTexture(const Mesh& mesh, const std::string& type)
+        {
+            for (const Texture& texture : mesh.textures)
+                if (texture.type == type)
+                    return &texture;
+            return nullptr;
+        }
+
+        // Fills pendingCommands and batches: every index range of a mesh with visible instances, and for a static
+        // batch each run of consecutive visible sub meshes inside a range (all of them visible is one command).
+        void buildCommands(const std::vector<unsigned char>* visible)
+        {
+            pendingCommands.clear();
+            batches.clear();
+            for (unsigned int mesh : order) {
+                const MeshDraw& draw = meshDraws[mesh];
+                if (batches.empty() || batches.back().indexType != draw.indexType)
+                    batches.push_back(Batch{draw.indexType, pendingCommands.size(), 0});
+                for (const IndexRange& range : draw.ranges) {
+                    // baseInstance picks the first of this mesh's entries in the draw id buffer
+                    if (draw.subMeshes.empty()) {
+                        if (visibleInstances[mesh])
+                            pendingCommands.push_back(DrawElementsIndirectCommand{range.count, visibleInstances[mesh],
+                                                                                  range.firstIndex, range.baseVertex,
+                                                                                  draw.firstInstance});
+                        continue;
+                    }
+                    bool open = false;
+                    for (size_t s = 0; s < draw.subMeshes.size(); s++) {
+                        const IndexRun& subMesh = draw.subMeshes[s];
+                        unsigned int first = std::max(subMesh.firstIndex, range.firstIndex);
+                        unsigned int end = std::min(subMesh.firstIndex + subMesh.count, range.firstIndex + range.count);
+                        if (first >= end || (visible && !(*visible)[draw.firstObject + s]))
+                            continue;
+                        if (open && pendingCommands.back().firstIndex + pendingCommands.back().count == first)
+                            pendingCommands.back().count = end - pendingCommands.back().firstIndex;
+                        else
+                            pendingCommands.push_back(DrawElementsIndirectCommand{end - first, 1, first, range.baseVertex,
+                                                                                  draw.firstInstance});
+                        open = true;
+                    }
+                }
+                batches.back().commandCount = pendingCommands.size() - batches.back().firstCommand;
+            }
+        }
+    };
+}
+
+#endif //PROJECT_BASE_INDIRECTDRAW_H
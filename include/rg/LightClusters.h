@@ -0,0 +1,303 @@
+//
+// Clustered light culling: lights are assigned to view space froxels on the CPU and the fragment shader
+// only evaluates the lights of the cluster it falls into.
+//
+
+#ifndef PROJECT_BASE_LIGHTCLUSTERS_H
+#define PROJECT_BASE_LIGHTCLUSTERS_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <rg/GLState.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <limits>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace rg {
+
+    const unsigned int CLUSTERS_X = 16;
+    const unsigned int CLUSTERS_Y = 9;
+    const unsigned int CLUSTERS_Z = 24;
+
+    // texture units the cluster buffers are bound to, above the texture arrays and per-draw buffers models use
+    const unsigned int LIGHT_DATA_TEXTURE_UNIT = 12;
+    const unsigned int LIGHT_GRID_TEXTURE_UNIT = 13;
+    const unsigned int LIGHT_INDEX_TEXTURE_UNIT = 14;
+
+    // a light stops being assigned to clusters once its strongest channel falls below this
+    const float LIGHT_CUTOFF = 0.01f;
+
+    // One light as seen by the shader: four RGBA32F texels of the light data buffer.
+    struct GpuPointLight {
+        glm::vec3 position;
+        float radius;
+        glm::vec3 ambient;
+        float constant;
+        glm::vec3 diffuse;
+        float linear;
+        glm::vec3 specular;
+        float quadratic;
+    };
+
+    static_assert(sizeof(GpuPointLight) == 64, "GpuPointLight must be exactly four vec4s");
+
+    // distance at which the attenuated light drops below LIGHT_CUTOFF
+    inline float LightRadius(float intensity, float constant, float linear, float quadratic, float maxRadius)
+    {
+        // solve quadratic * d^2 + linear * d + (constant - intensity / cutoff) = 0
+        float c = constant - intensity / LIGHT_CUTOFF;
+        if (c >= 0.0f)
+            return 0.0f;
+        float d;
+        if (quadratic > 0.0f)
+            d = (-linear + std::sqrt(linear * linear - 4.0f * quadratic * c)) / (2.0f * quadratic);
+        else if (linear > 0.0f)
+            d = -c / linear;
+        else
+            d = maxRadius;
+        return std::min(d, maxRadius);
+    }
+
+    struct LightClusterStats {
+        unsigned int lightCount = 0;
+        unsigned int visibleLights = 0;
+        unsigned int lightClusterPairs = 0;
+        unsigned int maxLightsPerCluster = 0;
+        double assignMs = 0.0;
+    };
+
+    class LightClusters {
+    public:
+        LightClusterStats stats;
+
+        // needs a current GL context
+        void Init()
+        {
+            GLint maxTexels = 65536;
+            glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &maxTexels);
+            maxIndices = (unsigned int)maxTexels;
+
+            glGenBuffers(3, buffers);
+            glGenTextures(3, textures);
+            const GLenum formats[3] = {GL_RGBA32F, GL_RG32UI, GL_R32UI};
+            for (int i = 0; i < 3; ++i) {
+                glBindBuffer(GL_TEXTURE_BUFFER, buffers[i]);
+                glBufferData(GL_TEXTURE_BUFFER, 16, NULL, GL_STREAM_DRAW);
+                glBindTexture(GL_TEXTURE_BUFFER, textures[i]);
+                glTexBuffer(GL_TEXTURE_BUFFER, formats[i], buffers[i]);
+            }
+            glBindTexture(GL_TEXTURE_BUFFER, 0);
+            glBindBuffer(GL_TEXTURE_BUFFER, 0);
+        }
+
+        // Assigns every light to the clusters its sphere of influence touches and uploads the result.
+        // Light positions are in world space, fovY in radians, near/far are positive distances,
+        // the viewport is the size of the framebuffer the lit geometry is rendered into.
+        void Update(const std::vector<GpuPointLight>& lights, const glm::mat4& view, float fovY, float aspect,
+                    float zNear, float zFar, unsigned int viewportWidth, unsigned int viewportHeight)
+        {
+            auto start = std::chrono::steady_clock::now();
+            if (fovY != builtFovY || aspect != builtAspect || zNear != builtNear || zFar != builtFar)
+                buildClusterBounds(fovY, aspect, zNear, zFar);
+
+            counts.assign(CLUSTERS_X * CLUSTERS_Y * CLUSTERS_Z, 0);
+            pairs.clear();
+            stats = LightClusterStats();
+            stats.lightCount = (unsigned int)lights.size();
+
+            float logRatio = std::log(zFar / zNear);
+            for (unsigned int l = 0; l < lights.size(); ++l) {
+                const GpuPointLight& light = lights[l];
+                glm::vec4 center = view * glm::vec4(light.position, 1.0f);
+                float depthMin = -center.z - light.radius;
+                float depthMax = -center.z + light.radius;
+                if (depthMax < zNear || depthMin > zFar || light.radius <= 0.0f)
+                    continue;
+                unsigned int firstSlice = sliceOf(std::max(depthMin, zNear), logRatio);
+                unsigned int lastSlice = sliceOf(std::min(depthMax, zFar), logRatio);
+                size_t pairsBefore = pairs.size();
+                for (unsigned int slice = firstSlice; slice <= lastSlice; ++slice)
+                    testSlice(slice, glm::vec3(center), light.radius, l);
+                if (pairs.size() != pairsBefore)
+                    stats.visibleLights++;
+            }
+
+            // counting sort of the (cluster, light) pairs into one flat index list
+            unsigned int clusterCount = CLUSTERS_X * CLUSTERS_Y * CLUSTERS_Z;
+            grid.resize(clusterCount * 2);
+            unsigned int offset = 0;
+            for (unsigned int c = 0; c < clusterCount; ++c) {
+                unsigned int count = counts[c];
+                if (offset + count > maxIndices)
+                    count = offset < maxIndices ? maxIndices - offset : 0;
+                grid[2 * c] = offset;
+                grid[2 * c + 1] = count;
+                counts[c] = 0;
+                offset += count;
+                stats.maxLightsPerCluster = std::max(stats.maxLightsPerCluster, count);
+            }
+            if (offset < pairs.size() && !warnedOverflow) {
+                std::cout << "WARNING::LIGHT_CLUSTERS::INDEX_LIST_FULL dropping "
+                          << pairs.size() - offset << " light assignments" << std::endl;
+                warnedOverflow = true;
+            }
+            indices.resize(std::max(offset, 1u));
+            for (const std::pair<uint32_t, uint32_t>& pair : pairs) {
+                unsigned int c = pair.first;
+                if (counts[c] < grid[2 * c + 1])
+                    indices[grid[2 * c] + counts[c]++] = pair.second;
+            }
+            stats.lightClusterPairs = offset;
+
+            upload(0, lights.data(), std::max<size_t>(lights.size(), 1) * sizeof(GpuPointLight));
+            upload(1, grid.data(), grid.size() * sizeof(uint32_t));
+            upload(2, indices.data(), indices.size() * sizeof(uint32_t));
+
+            // fragment shader maps gl_FragCoord.xy * tileScale to a tile and log(depth) * scale + bias to a slice
+            tileScale = glm::vec2((float)CLUSTERS_X / viewportWidth, (float)CLUSTERS_Y / viewportHeight);
+            sliceScale = CLUSTERS_Z / logRatio;
+            sliceBias = -(float)CLUSTERS_Z * std::log(zNear) / logRatio;
+            stats.assignMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        }
+
+        void Bind() const
+        {
+            GLCache().BindTexture(LIGHT_DATA_TEXTURE_UNIT, GL_TEXTURE_BUFFER, textures[0]);
+            GLCache().BindTexture(LIGHT_GRID_TEXTURE_UNIT, GL_TEXTURE_BUFFER, textures[1]);
+            GLCache().BindTexture(LIGHT_INDEX_TEXTURE_UNIT, GL_TEXTURE_BUFFER, textures[2]);
+        }
+
+        // parameters for the Lights uniform block: tiles per pixel, slice scale and bias
+        glm::vec4 Params() const { return glm::vec4(tileScale.x, tileScale.y, sliceScale, sliceBias); }
+
+    private:
+        unsigned int buffers[3] = {0, 0, 0};
+        unsigned int textures[3] = {0, 0, 0};
+        unsigned int maxIndices = 65536;
+        bool warnedOverflow = false;
+
+        float builtFovY = 0.0f, builtAspect = 0.0f, builtNear = 0.0f, builtFar = 0.0f;
+        glm::vec2 tileScale = glm::vec2(0.0f);
+        float sliceScale = 0.0f, sliceBias = 0.0f;
+
+        // view space AABB of every cluster, structure of arrays so a slice can be tested four clusters at a time.
+        // each slice is padded to a multiple of four with boxes nothing can intersect.
+        static const unsigned int SLICE_STRIDE = (CLUSTERS_X * CLUSTERS_Y + 3) / 4 * 4;
+        std::vector<float> minX, minY, minZ, maxX, maxY, maxZ;
+
+        std::vector<uint32_t> counts;
+        std::vector<std::pair<uint32_t, uint32_t>> pairs;
+        std::vector<uint32_t> grid;
+        std::vector<uint32_t> indices;
+
+        unsigned int sliceOf(float depth, float logRatio) const
+        {
+            int slice = (int)(std::log(depth / builtNear) / logRatio * CLUSTERS_Z);
+            return (unsigned int)std::min(std::max(slice, 0), (int)CLUSTERS_Z - 1);
+        }
+
+        void buildClusterBounds(float fovY, float aspect, float zNear, float zFar)
+        {
+            builtFovY = fovY;
+            builtAspect = aspect;
+            builtNear = zNear;
+            builtFar = zFar;
+
+            const float inf = std::numeric_limits<float>::infinity();
+            size_t total = SLICE_STRIDE * CLUSTERS_Z;
+            minX.assign(total, inf);
+            minY.assign(total, inf);
+            minZ.assign(total, inf);
+            maxX.assign(total, -inf);
+            maxY.assign(total, -inf);
+            maxZ.assign(total, -inf);
+
+            float tanY = std::tan(fovY * 0.5f);
+            float tanX = tanY * aspect;
+            for (unsigned int z = 0; z < CLUSTERS_Z; ++z) {
+                float sliceNear = zNear * std::pow(zFar / zNear, (float)z / CLUSTERS_Z);
+                float sliceFar = zNear * std::pow(zFar / zNear, (float)(z + 1) / CLUSTERS_Z);
+                for (unsigned int y = 0; y < CLUSTERS_Y; ++y) {
+                    for (unsigned int x = 0; x < CLUSTERS_X; ++x) {
+                        float ndcX0 = -1.0f + 2.0f * x / CLUSTERS_X, ndcX1 = -1.0f + 2.0f * (x + 1) / CLUSTERS_X;
+                        float ndcY0 = -1.0f + 2.0f * y / CLUSTERS_Y, ndcY1 = -1.0f + 2.0f * (y + 1) / CLUSTERS_Y;
+                        size_t i = z * SLICE_STRIDE + y * CLUSTERS_X + x;
+                        // the froxel is bounded by its eight corners (view space looks down -z)
+                        for (float depth : {sliceNear, sliceFar}) {
+                            for (float ndcX : {ndcX0, ndcX1}) {
+                                for (float ndcY : {ndcY0, ndcY1}) {
+                                    float vx = ndcX * tanX * depth, vy = ndcY * tanY * depth, vz = -depth;
+                                    minX[i] = std::min(minX[i], vx); maxX[i] = std::max(maxX[i], vx);
+                                    minY[i] = std::min(minY[i], vy); maxY[i] = std::max(maxY[i], vy);
+                                    minZ[i] = std::min(minZ[i], vz); maxZ[i] = std::max(maxZ[i], vz);
+                                }
+                            }
+                        }
+                    }
+                }
+            }
+        }
+
+        // sphere vs AABB against every cluster of one slice, records a pair per intersection
+        void testSlice(unsigned int slice, glm::vec3 center, float radius, unsigned int light)
+        {
+            size_t base = slice * SLICE_STRIDE;
+            float radius2 = radius * radius;
+#if defined(__SSE2__)
+            const __m128 zero = _mm_setzero_ps();
+            const __m128 cx = _mm_set1_ps(center.x), cy = _mm_set1_ps(center.y), cz = _mm_set1_ps(center.z);
+            const __m128 r2 = _mm_set1_ps(radius2);
+            for (size_t i = 0; i < SLICE_STRIDE; i += 4) {
+                size_t at = base + i;
+                __m128 dx = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(&minX[at]), cx),
+                                                  _mm_sub_ps(cx, _mm_loadu_ps(&maxX[at]))), zero);
+                __m128 dy = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(&minY[at]), cy),
+                                                  _mm_sub_ps(cy, _mm_loadu_ps(&maxY[at]))), zero);
+                __m128 dz = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(&minZ[at]), cz),
+                                                  _mm_sub_ps(cz, _mm_loadu_ps(&maxZ[at]))), zero);
+                __m128 d2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+                int mask = _mm_movemask_ps(_mm_cmple_ps(d2, r2));
+                while (mask) {
+                    int lane = __builtin_ctz(mask);
+                    addPair((unsigned int)(slice * CLUSTERS_X * CLUSTERS_Y + i + lane), light);
+                    mask &= mask - 1;
+                }
+            }
+#else
+            for (size_t i = 0; i < CLUSTERS_X * CLUSTERS_Y; ++i) {
+                size_t at = base + i;
+                float dx = std::max(std::max(minX[at] - center.x, center.x - maxX[at]), 0.0f);
+                float dy = std::max(std::max(minY[at] - center.y, center.y - maxY[at]), 0.0f);
+                float dz = std::max(std::max(minZ[at] - center.z, center.z - maxZ[at]), 0.0f);
+                if (dx * dx + dy * dy + dz * dz <= radius2)
+                    addPair((unsigned int)(slice * CLUSTERS_X * CLUSTERS_Y + i), light);
+            }
+#endif
+        }
+
+        void addPair(unsigned int cluster, unsigned int light)
+        {
+            counts[cluster]++;
+            pairs.emplace_back(cluster, light);
+        }
+
+        void upload(int i, const void* data, size_t size)
+        {
+            glBindBuffer(GL_TEXTURE_BUFFER, buffers[i]);
+            glBufferData(GL_TEXTURE_BUFFER, size, NULL, GL_STREAM_DRAW); // orphan last frame's storage
+            glBufferSubData(GL_TEXTURE_BUFFER, 0, size, data);
+            glBindBuffer(GL_TEXTURE_BUFFER, 0);
+        }
+    };
+}
+
+#endif //PROJECT_BASE_LIGHTCLUSTERS_H
@@ -0,0 +1,374 @@
+//
+// Binary mesh cache written next to a model the first time Assimp imports it.
+//
+
+#ifndef PROJECT_BASE_MESHCACHE_H
+#define PROJECT_BASE_MESHCACHE_H
+
+#include <learnopengl/mesh.h>
+#include <rg/Hash.h>
+
+#include <cctype>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace rg {
+
+    // bump whenever the layout below or the meaning of the cached data changes
+    // 2: index and vertex order optimized at import (MeshOptimizer.h)
+    // 3: identical vertices welded at import (VertexWelder.h)
+    // 4: repeated meshes stored once in local space with their instances (MeshInstancing.h)
+    const uint32_t MESH_CACHE_VERSION = 4;
+    const char MESH_CACHE_MAGIC[4] = {'R', 'G', 'M', 'C'};
+
+    // On-disk layout (every offset is relative to the start of the file):
+    //   MeshCacheHeader
+    //   MeshCacheEntry[meshCount]
+    //   MeshCacheTextureRef[textureRefCount]
+    //   MeshCacheInstance[instanceCount]
+    //   string table (NUL-terminated texture types and paths)
+    //   Vertex[]        (16 byte aligned, all meshes back to back)
+    //   unsigned int[]  (16 byte aligned, all meshes back to back)
+    //   glm::vec2[]     (instance texture coordinate sets, all meshes back to back)
+    // so a mapped file can be handed to glBufferData without any parsing.
+    struct MeshCacheHeader {
+        char magic[4];
+        uint32_t version;
+        uint64_t sourceHash;
+        uint32_t postProcessFlags;
+        uint32_t vertexStride;
+        uint32_t meshCount;
+        uint32_t textureRefCount;
+        uint32_t instanceCount;
+        uint32_t padding;
+        uint64_t stringTableOffset;
+        uint64_t vertexDataOffset;
+        uint64_t indexDataOffset;
+        uint64_t texCoordDataOffset;
+        uint64_t fileSize;
+    };
+
+    struct MeshCacheEntry {
+        uint64_t firstVertex;
+        uint64_t firstIndex;
+        uint32_t vertexCount;
+        uint32_t indexCount;
+        uint32_t firstTextureRef;
+        uint32_t textureRefCount;
+        uint32_t firstInstance;
+        uint32_t instanceCount;
+        uint64_t firstTexCoord;
+        uint32_t texCoordCount;
+        uint32_t padding;
+        float aabbMin[3];
+        float aabbMax[3];
+    };
+
+    struct MeshCacheTextureRef {
+        uint32_t typeOffset;
+        uint32_t pathOffset;
+    };
+
+    struct MeshCacheInstance {
+        float transform[16];  // column major, as glm stores a mat4
+        int32_t texCoordSet;
+    };
+
+    // Read-only view of a cache file. The file is memory mapped, all pointers handed out stay valid
+    // for as long as the MeshCacheFile object lives.
+    class MeshCacheFile {
+    public:
+        MeshCacheFile() = default;
+        MeshCacheFile(const MeshCacheFile&) = delete;
+        MeshCacheFile& operator=(const MeshCacheFile&) = delete;
+        ~MeshCacheFile() { Close(); }
+
+        // maps the file and validates it against the source hash and import flags it is expected to match
+        bool Open(const std::string& path, uint64_t sourceHash, uint32_t postProcessFlags)
+        {
+            Close();
+            int fd = open(path.c_str(), O_RDONLY);
+            if (fd < 0)
+                return false;
+            struct stat st;
+            if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(MeshCacheHeader)) {
+                close(fd);
+                return false;
+            }
+            size = (size_t)st.st_size;
+            void* mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            close(fd);
+            if (mapped == MAP_FAILED)
+                return false;
+            data = static_cast<const unsigned char*>(mapped);
+
+            if (!validate(sourceHash, postProcessFlags)) {
+                Close();
+                return false;
+            }
+            return true;
+        }
+
+        void Close()
+        {
+            if (data)
+                munmap(const_cast<unsigned char*>(data), size);
+            data = nullptr;
+            size = 0;
+        }
+
+        const MeshCacheHeader& Header() const { return *reinterpret_cast<const MeshCacheHeader*>(data); }
+        const MeshCacheEntry& Entry(unsigned int i) const
+        {
+            return reinterpret_cast<const MeshCacheEntry*>(data + sizeof(MeshCacheHeader))[i];
+        }
+        const MeshCacheTextureRef& TextureRef(unsigned int i) const
+        {
+            const unsigned char* refs = data + sizeof(MeshCacheHeader) + Header().meshCount * sizeof(MeshCacheEntry);
+            return reinterpret_cast<const MeshCacheTextureRef*>(refs)[i];
+        }
+        MeshInstance Instance(unsigned int i) const
+        {
+            const unsigned char* instances = data + sizeof(MeshCacheHeader) + Header().meshCount * sizeof(MeshCacheEntry)
+                                             + Header().textureRefCount * sizeof(MeshCacheTextureRef);
+            const MeshCacheInstance& stored = reinterpret_cast<const MeshCacheInstance*>(instances)[i];
+            MeshInstance instance;
+            std::memcpy(&instance.transform[0][0], stored.transform, sizeof(stored.transform));
+            instance.texCoordSet = stored.texCoordSet;
+            return instance;
+        }
+        const char* String(uint32_t offset) const
+        {
+            return reinterpret_cast<const char*>(data + Header().stringTableOffset + offset);
+        }
+        const Vertex* Vertices(const MeshCacheEntry& entry) const
+        {
+            return reinterpret_cast<const Vertex*>(data + Header().vertexDataOffset) + entry.firstVertex;
+        }
+        const unsigned int* Indices(const MeshCacheEntry& entry) const
+        {
+            return reinterpret_cast<const unsigned int*>(data + Header().indexDataOffset) + entry.firstIndex;
+        }
+        const glm::vec2* TexCoords(const MeshCacheEntry& entry) const
+        {
+            return reinterpret_cast<const glm::vec2*>(data + Header().texCoordDataOffset) + entry.firstTexCoord;
+        }
+
+    private:
+        const unsigned char* data = nullptr;
+        size_t size = 0;
+
+        bool validate(uint64_t sourceHash, uint32_t postProcessFlags) const
+        {
+            const MeshCacheHeader& header = Header();
+            if (std::memcmp(header.magic, MESH_CACHE_MAGIC, sizeof(header.magic)) != 0
+                || header.version != MESH_CACHE_VERSION
+                || header.vertexStride != sizeof(Vertex)
+                || header.sourceHash != sourceHash
+                || header.postProcessFlags != postProcessFlags
+                || header.fileSize != size)
+                return false;
+
+            // make sure every range the loader is going to touch lies inside the file
+            uint64_t tablesEnd = sizeof(MeshCacheHeader)
+                                 + (uint64_t)header.meshCount * sizeof(MeshCacheEntry)
+                                 + (uint64_t)header.textureRefCount * sizeof(MeshCacheTextureRef)
+                                 + (uint64_t)header.instanceCount * sizeof(MeshCacheInstance);
+            if (tablesEnd > header.stringTableOffset || header.stringTableOffset > header.vertexDataOffset
+                || header.vertexDataOffset > header.indexDataOffset || header.indexDataOffset > header.texCoordDataOffset
+                || header.texCoordDataOffset > size)
+                return false;
+            uint64_t vertexCapacity = (header.indexDataOffset - header.vertexDataOffset) / sizeof(Vertex);
+            uint64_t indexCapacity = (header.texCoordDataOffset - header.indexDataOffset) / sizeof(unsigned int);
+            uint64_t texCoordCapacity = (size - header.texCoordDataOffset) / sizeof(glm::vec2);
+            for (unsigned int i = 0; i < header.meshCount; ++i) {
+                const MeshCacheEntry& entry = Entry(i);
+                if (entry.firstVertex + entry.vertexCount > vertexCapacity
+                    || entry.firstIndex + entry.indexCount > indexCapacity
+                    || (uint64_t)entry.firstTextureRef + entry.textureRefCount > header.textureRefCount
+                    || (uint64_t)entry.firstInstance + entry.instanceCount > header.instanceCount
+                    || entry.firstTexCoord + entry.texCoordCount > texCoordCapacity
+                    || entry.indexCount % 3 != 0)
+                    return false;
+                // whole triangles, every index naming a vertex of its own mesh
+                const unsigned int* indices = Indices(entry);
+                for (uint32_t j = 0; j < entry.indexCount; ++j)
+                    if (indices[j] >= entry.vertexCount)
+                        return false;
+                for (unsigned int j = 0; j < entry.instanceCount; ++j) {
+                    int32_t set = Instance(entry.firstInstance + j).texCoordSet;
+                    if (set >= 0 && ((uint64_t)set + 1) * entry.vertexCount > entry.texCoordCount)
+                        return false;
+                }
+            }
+            // every string starts inside the string table and is terminated before it ends
+            uint64_t stringTableSize = header.vertexDataOffset - header.stringTableOffset;
+            for (unsigned int i = 0; i < header.textureRefCount; ++i) {
+                const MeshCacheTextureRef& ref = TextureRef(i);
+                if (!terminatedString(ref.typeOffset, stringTableSize) || !terminatedString(ref.pathOffset, stringTableSize))
+                    return false;
+            }
+            return true;
+        }
+
+        bool terminatedString(uint32_t offset, uint64_t stringTableSize) const
+        {
+            if (offset >= stringTableSize)
+                return false;
+            const unsigned char* start = data + Header().stringTableOffset + offset;
+            return std::memchr(start, '\0', (size_t)(stringTableSize - offset)) != nullptr;
+        }
+    };
+
+    // Hash of everything an import reads: the model file and, for Wavefront OBJ, the material libraries its mtllib
+    // lines name, so editing a .mtl invalidates the cache as well. A library that exists under neither its own
+    // name nor the fallback name hashes as its name only, creating it later changes the key too.
+    inline bool HashMeshSource(const std::string& path, uint64_t& hash)
+    {
+        if (!HashFile(path, hash))
+            return false;
+        std::string extension = path.substr(path.find_last_of('.') + 1);
+        for (char& c : extension)
+            c = (char)std::tolower((unsigned char)c);
+        if (extension != "obj")
+            return true;
+
+        std::string directory = path.substr(0, path.find_last_of('/') + 1);
+        std::ifstream in(path);
+        std::string line;
+        while (std::getline(in, line)) {
+            size_t start = line.find_first_not_of(" \t");
+            if (start == std::string::npos || line.compare(start, 6, "mtllib") != 0)
+                continue;
+            // the rest of the line is one file name, as Assimp reads it
+            size_t nameStart = line.find_first_not_of(" \t", start + 6);
+            size_t nameEnd = line.find_last_not_of(" \t\r");
+            if (nameStart == std::string::npos || nameStart == start + 6)
+                continue;
+            std::string library = line.substr(nameStart, nameEnd + 1 - nameStart);
+            // Assimp falls back to the .mtl named after the model when the library is missing
+            uint64_t libraryHash = 0;
+            if (!HashFile(directory + library, libraryHash)
+                && !HashFile(path.substr(0, path.size() - extension.size()) + "mtl", libraryHash))
+                libraryHash = 0;
+            hash = HashBytes(library.data(), library.size(), hash);
+            hash = HashBytes(&libraryHash, sizeof(libraryHash), hash);
+        }
+        return true;
+    }
+
+    // Serializes already processed meshes. Written to a temporary file first and renamed,
+    // so a crash halfway through never leaves a truncated cache behind.
+    inline bool WriteMeshCache(const std::string& path, uint64_t sourceHash, uint32_t postProcessFlags,
+                               const std::vector<Mesh>& meshes)
+    {
+        auto align16 = [](uint64_t offset) { return (offset + 15) & ~uint64_t(15); };
+
+        std::vector<MeshCacheEntry> entries;
+        std::vector<MeshCacheTextureRef> textureRefs;
+        std::vector<MeshCacheInstance> instances;
+        std::string strings;
+        uint64_t vertexCount = 0, indexCount = 0, texCoordCount = 0;
+        for (const Mesh& mesh : meshes) {
+            MeshCacheEntry entry;
+            entry.firstVertex = vertexCount;
+            entry.firstIndex = indexCount;
+            entry.vertexCount = (uint32_t)mesh.vertices.size();
+            entry.indexCount = (uint32_t)mesh.indices.size();
+            entry.firstTextureRef = (uint32_t)textureRefs.size();
+            entry.textureRefCount = (uint32_t)mesh.textures.size();
+            entry.firstInstance = (uint32_t)instances.size();
+            entry.instanceCount = (uint32_t)mesh.instances.size();
+            entry.firstTexCoord = texCoordCount;
+            entry.texCoordCount = (uint32_t)mesh.instanceTexCoords.size();
+            entry.padding = 0;
+            for (const MeshInstance& instance : mesh.instances) {
+                MeshCacheInstance stored;
+                std::memcpy(stored.transform, &instance.transform[0][0], sizeof(stored.transform));
+                stored.texCoordSet = instance.texCoordSet;
+                instances.push_back(stored);
+            }
+            for (int k = 0; k < 3; ++k) {
+                entry.aabbMin[k] = mesh.aabbMin[k];
+                entry.aabbMax[k] = mesh.aabbMax[k];
+            }
+            for (const Texture& texture : mesh.textures) {
+                MeshCacheTextureRef ref;
+                ref.typeOffset = (uint32_t)strings.size();
+                strings.append(texture.type).push_back('\0');
+                ref.pathOffset = (uint32_t)strings.size();
+                strings.append(texture.path).push_back('\0');
+                textureRefs.push_back(ref);
+            }
+            vertexCount += mesh.vertices.size();
+            indexCount += mesh.indices.size();
+            texCoordCount += mesh.instanceTexCoords.size();
+            entries.push_back(entry);
+        }
+
+        MeshCacheHeader header;
+        std::memcpy(header.magic, MESH_CACHE_MAGIC, sizeof(header.magic));
+        header.version = MESH_CACHE_VERSION;
+        header.sourceHash = sourceHash;
+        header.postProcessFlags = postProcessFlags;
+        header.vertexStride = sizeof(Vertex);
+        header.meshCount = (uint32_t)entries.size();
+        header.textureRefCount = (uint32_t)textureRefs.size();
+        header.instanceCount = (uint32_t)instances.size();
+        header.padding = 0;
+        header.stringTableOffset = sizeof(MeshCacheHeader) + entries.size() * sizeof(MeshCacheEntry)
+                                   + textureRefs.size() * sizeof(MeshCacheTextureRef)
+                                   + instances.size() * sizeof(MeshCacheInstance);
+        header.vertexDataOffset = align16(header.stringTableOffset + strings.size());
+        header.indexDataOffset = align16(header.vertexDataOffset + vertexCount * sizeof(Vertex));
+        header.texCoordDataOffset = align16(header.indexDataOffset + indexCount * sizeof(unsigned int));
+        header.fileSize = header.texCoordDataOffset + texCoordCount * sizeof(glm::vec2);
+
+        std::string tmpPath = path + ".tmp";
+        std::ofstream out(tmpPath, std::ios::binary | std::ios::trunc);
+        if (!out) {
+            std::cout << "ERROR::MESH_CACHE::CANNOT_WRITE " << tmpPath << std::endl;
+            return false;
+        }
+        auto padTo = [&out](uint64_t offset) {
+            static const char zeros[16] = {0};
+            uint64_t at = (uint64_t)out.tellp();
+            if (offset > at)
+                out.write(zeros, offset - at);
+        };
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char*>(entries.data()), entries.size() * sizeof(MeshCacheEntry));
+        out.write(reinterpret_cast<const char*>(textureRefs.data()), textureRefs.size() * sizeof(MeshCacheTextureRef));
+        out.write(reinterpret_cast<const char*>(instances.data()), instances.size() * sizeof(MeshCacheInstance));
+        out.write(strings.data(), strings.size());
+        padTo(header.vertexDataOffset);
+        for (const Mesh& mesh : meshes)
+            out.write(reinterpret_cast<const char*>(mesh.vertices.data()), mesh.vertices.size() * sizeof(Vertex));
+        padTo(header.indexDataOffset);
+        for (const Mesh& mesh : meshes)
+            out.write(reinterpret_cast<const char*>(mesh.indices.data()), mesh.indices.size() * sizeof(unsigned int));
+        padTo(header.texCoordDataOffset);
+        for (const Mesh& mesh : meshes)
+            out.write(reinterpret_cast<const char*>(mesh.instanceTexCoords.data()),
+                      mesh.instanceTexCoords.size() * sizeof(glm::vec2));
+        out.close();
+        if (!out || std::rename(tmpPath.c_str(), path.c_str()) != 0) {
+            std::cout << "ERROR::MESH_CACHE::CANNOT_WRITE " << path << std::endl;
+            std::remove(tmpPath.c_str());
+            return false;
+        }
+        return true;
+    }
+}
+
+#endif //PROJECT_BASE_MESHCACHE_H
@@ -0,0 +1,134 @@
+//
+// Repeated geometry found at import: every mesh is moved into a local space around its bounding box center
+// and hashed, meshes with the same geometry are kept once and drawn instanced with one transform per copy.
+// Copies often sit in their own part of a texture atlas, so a copy may bring its own texture coordinates.
+//
+
+#ifndef PROJECT_BASE_MESHINSTANCING_H
+#define PROJECT_BASE_MESHINSTANCING_H
+
+#include <learnopengl/mesh.h>
+#include <rg/Hash.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <map>
+#include <vector>
+
+namespace rg {
+
+    // moves the vertices so their bounding box is centered on the origin and returns where the center was,
+    // copies placed at different spots of the source file end up with the same local positions
+    inline glm::vec3 CenterVertices(std::vector<Vertex>& vertices)
+    {
+        if (vertices.empty())
+            return glm::vec3(0.0f);
+        glm::vec3 boundsMin = vertices[0].Position, boundsMax = vertices[0].Position;
+        for (const Vertex& vertex : vertices) {
+            boundsMin = glm::min(boundsMin, vertex.Position);
+            boundsMax = glm::max(boundsMax, vertex.Position);
+        }
+        glm::vec3 center = (boundsMin + boundsMax) * 0.5f;
+        for (Vertex& vertex : vertices)
+            vertex.Position -= center;
+        return center;
+    }
+
+    // Hash of the triangles and of the local positions snapped to 1/256 of the mesh size, coarse enough for
+    // the float noise between copies to rarely change it; SameGeometry has the final word on equal hashes.
+    inline uint64_t HashGeometry(const std::vector<Vertex>& vertices, const std::vector<unsigned int>& indices)
+    {
+        float largest = 0.0f;
+        for (const Vertex& vertex : vertices)
+            largest = std::max(largest, std::max(std::fabs(vertex.Position.x),
+                                                 std::max(std::fabs(vertex.Position.y), std::fabs(vertex.Position.z))));
+        const float scale = largest > 0.0f ? 128.0f / largest : 1.0f;
+
+        uint64_t counts[2] = {vertices.size(), indices.size()};
+        uint64_t hash = HashBytes(counts, sizeof(counts));
+        hash = HashBytes(indices.data(), indices.size() * sizeof(unsigned int), hash);
+        std::vector<int32_t> quantized;
+        quantized.reserve(vertices.size() * 3);
+        for (const Vertex& vertex : vertices)
+            for (int axis = 0; axis < 3; axis++)
+                quantized.push_back((int32_t)std::lround(vertex.Position[axis] * scale));
+        return HashBytes(quantized.data(), quantized.size() * sizeof(int32_t), hash);
+    }
+
+    // true if both (centered) meshes have the same triangles and every vertex matches: positions within
+    // tolerance of the mesh size, normals within normalTolerance (files like OBJ round them to a few digits,
+    // differently for every copy). Texture coordinates may differ.
+    inline bool SameGeometry(const std::vector<Vertex>& verticesA, const std::vector<unsigned int>& indicesA,
+                             const std::vector<Vertex>& verticesB, const std::vector<unsigned int>& indicesB,
+                             float tolerance = 1e-4f, float normalTolerance = 2e-3f)
+    {
+        if (verticesA.size() != verticesB.size() || indicesA != indicesB)
+            return false;
+        float largest = 0.0f;
+        for (const Vertex& vertex : verticesA)
+            largest = std::max(largest, glm::length(vertex.Position));
+        const float positionTolerance = tolerance * std::max(largest, 1e-3f);
+        auto close = [](float a, float b, float limit) { return std::fabs(a - b) <= limit; };
+        for (size_t i = 0; i < verticesA.size(); i++) {
+            const Vertex& a = verticesA[i];
+            const Vertex& b = verticesB[i];
+            for (int axis = 0; axis < 3; axis++)
+                if (!close(a.Position[axis], b.Position[axis], positionTolerance)
+                    || !close(a.Normal[axis], b.Normal[axis], normalTolerance))
+                    return false;
+        }
+        return true;
+    }
+
+    // true if a copy's texture coordinates are the ones the vertices already have
+    inline bool SameTexCoords(const std::vector<Vertex>& vertices, const std::vector<glm::vec2>& texCoords,
+                              float tolerance = 1e-4f)
+    {
+        if (vertices.size() != texCoords.size())
+            return false;
+        for (size_t i = 0; i < vertices.size(); i++)
+            if (std::fabs(vertices[i].TexCoords.x - texCoords[i].x) > tolerance
+                || std::fabs(vertices[i].TexCoords.y - texCoords[i].y) > tolerance)
+                return false;
+        return true;
+    }
+
+    // One class per vertex for WeldVertices: vertices get the same class only where every copy's texture
+    // coordinates match too, so welding never merges what a copy keeps apart.
+    inline std::vector<uint32_t> TexCoordClasses(const std::vector<std::vector<glm::vec2>>& copyTexCoords,
+                                                 size_t vertexCount)
+    {
+        std::vector<uint32_t> classes(vertexCount, 0);
+        if (copyTexCoords.empty())
+            return classes;
+        std::map<std::vector<int32_t>, uint32_t> ids;
+        std::vector<int32_t> key(copyTexCoords.size() * 2);
+        for (size_t i = 0; i < vertexCount; i++) {
+            for (size_t set = 0; set < copyTexCoords.size(); set++) {
+                key[2 * set] = (int32_t)std::lround((double)copyTexCoords[set][i].x * 65536.0);
+                key[2 * set + 1] = (int32_t)std::lround((double)copyTexCoords[set][i].y * 65536.0);
+            }
+            classes[i] = ids.insert(std::make_pair(key, (uint32_t)ids.size())).first->second;
+        }
+        return classes;
+    }
+
+    // Texture coordinates of a copy given per input vertex, moved along with the vertices through welding
+    // (weldRemap) and optimization (optimizeRemap) into the final order of vertexCount vertices.
+    inline std::vector<glm::vec2> RemapTexCoords(const std::vector<glm::vec2>& texCoords,
+                                                 const std::vector<unsigned int>& weldRemap,
+                                                 const std::vector<unsigned int>& optimizeRemap, size_t vertexCount)
+    {
+        std::vector<glm::vec2> remapped(vertexCount);
+        for (size_t i = 0; i < texCoords.size(); i++) {
+            unsigned int target = optimizeRemap[weldRemap[i]];
+            if (target != std::numeric_limits<unsigned int>::max())
+                remapped[target] = texCoords[i];
+        }
+        return remapped;
+    }
+}
+
+#endif //PROJECT_BASE_MESHINSTANCING_H
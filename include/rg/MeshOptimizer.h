@@ -0,0 +1,260 @@
+//
+// Index/vertex buffer reordering done once at import: triangle order for the post-transform vertex cache
+// (Forsyth's linear speed algorithm), cluster order against overdraw, vertex order for fetch locality.
+//
+
+#ifndef PROJECT_BASE_MESHOPTIMIZER_H
+#define PROJECT_BASE_MESHOPTIMIZER_H
+
+#include <learnopengl/mesh.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+namespace rg {
+
+    // ACMR: transformed vertices per triangle (0.5 is ideal for big regular grids, 3 the worst).
+    // ATVR: transformed vertices per referenced vertex (1 means every vertex is shaded exactly once).
+    struct VertexCacheStats {
+        float acmr = 0.0f;
+        float atvr = 0.0f;
+    };
+
+    // simulates a FIFO post-transform cache, small enough to be pessimistic for current GPUs
+    inline VertexCacheStats AnalyzeVertexCache(const std::vector<unsigned int>& indices, size_t vertexCount,
+                                               unsigned int cacheSize = 16)
+    {
+        VertexCacheStats stats;
+        if (indices.size() < 3)
+            return stats;
+        std::vector<unsigned int> timestamps(vertexCount, 0);
+        unsigned int time = cacheSize + 1;
+        size_t misses = 0, referenced = 0;
+        for (unsigned int index : indices) {
+            if (timestamps[index] == 0)
+                referenced++;
+            if (time - timestamps[index] > cacheSize) {
+                timestamps[index] = time++;
+                misses++;
+            }
+        }
+        stats.acmr = (float)misses / (float)(indices.size() / 3);
+        stats.atvr = (float)misses / (float)referenced;
+        return stats;
+    }
+
+    // Reorders triangles so vertices are reused while they are still in the post-transform cache.
+    inline void OptimizeVertexCache(std::vector<unsigned int>& indices, size_t vertexCount)
+    {
+        const int CACHE_SIZE = 32;
+        const size_t triangleCount = indices.size() / 3;
+        if (triangleCount == 0)
+            return;
+
+        auto vertexScore = [CACHE_SIZE](int cachePosition, unsigned int liveTriangles) {
+            if (liveTriangles == 0)
+                return -1.0f;
+            float score = 0.0f;
+            if (cachePosition >= 0) {
+                // the last triangle's vertices get a fixed score, so they are not preferred over the others
+                score = cachePosition < 3 ? 0.75f
+                                          : std::pow(1.0f - (float)(cachePosition - 3) / (CACHE_SIZE - 3), 1.5f);
+            }
+            // favour vertices with few triangles left, so they are finished off instead of left behind
+            return score + 2.0f / std::sqrt((float)liveTriangles);
+        };
+
+        // triangles of every vertex; the first live[v] entries are the ones not emitted yet
+        std::vector<unsigned int> live(vertexCount, 0), offsets(vertexCount + 1, 0), adjacency(indices.size());
+        for (unsigned int index : indices)
+            live[index]++;
+        for (size_t v = 0; v < vertexCount; v++)
+            offsets[v + 1] = offsets[v] + live[v];
+        std::vector<unsigned int> fill(offsets.begin(), offsets.end() - 1);
+        for (size_t t = 0; t < triangleCount; t++)
+            for (int k = 0; k < 3; k++)
+                adjacency[fill[indices[t * 3 + k]]++] = (unsigned int)t;
+
+        std::vector<int> cachePosition(vertexCount, -1);
+        std::vector<float> score(vertexCount);
+        for (size_t v = 0; v < vertexCount; v++)
+            score[v] = vertexScore(-1, live[v]);
+        std::vector<float> triangleScore(triangleCount);
+        std::vector<bool> emitted(triangleCount, false);
+        int best = 0;
+        for (size_t t = 0; t < triangleCount; t++) {
+            triangleScore[t] = score[indices[t * 3]] + score[indices[t * 3 + 1]] + score[indices[t * 3 + 2]];
+            if (triangleScore[t] > triangleScore[best])
+                best = (int)t;
+        }
+
+        std::vector<unsigned int> result;
+        result.reserve(indices.size());
+        std::vector<unsigned int> cache, nextCache;
+        size_t cursor = 0;
+        while (result.size() < indices.size()) {
+            if (best < 0) {
+                // nothing in the cache has triangles left, continue with the next unused one
+                while (emitted[cursor])
+                    cursor++;
+                best = (int)cursor;
+            }
+            emitted[best] = true;
+            const unsigned int* triangle = &indices[best * 3];
+            result.insert(result.end(), triangle, triangle + 3);
+
+            for (int k = 0; k < 3; k++) {
+                unsigned int v = triangle[k];
+                unsigned int* list = &adjacency[offsets[v]];
+                unsigned int* found = std::find(list, list + live[v], (unsigned int)best);
+                std::swap(*found, list[live[v] - 1]);
+                live[v]--;
+            }
+
+            // the triangle's vertices move to the front, everything else shifts back (and may fall out)
+            nextCache.assign(triangle, triangle + 3);
+            for (unsigned int v : cache)
+                if (v != triangle[0] && v != triangle[1] && v != triangle[2])
+                    nextCache.push_back(v);
+            for (size_t i = 0; i < nextCache.size(); i++) {
+                unsigned int v = nextCache[i];
+                cachePosition[v] = i < (size_t)CACHE_SIZE ? (int)i : -1;
+                score[v] = vertexScore(cachePosition[v], live[v]);
+            }
+
+            // only triangles touching the cache changed their score, the best of them goes next
+            best = -1;
+            float bestScore = -std::numeric_limits<float>::max();
+            for (unsigned int v : nextCache) {
+                for (unsigned int i = 0; i < live[v]; i++) {
+                    unsigned int t = adjacency[offsets[v] + i];
+                    triangleScore[t] = score[indices[t * 3]] + score[indices[t * 3 + 1]] + score[indices[t * 3 + 2]];
+                    if (cachePosition[v] >= 0 && triangleScore[t] > bestScore) {
+                        bestScore = triangleScore[t];
+                        best = (int)t;
+                    }
+                }
+            }
+            if (nextCache.size() > (size_t)CACHE_SIZE)
+                nextCache.resize(CACHE_SIZE);
+            cache.swap(nextCache);
+        }
+        indices.swap(result);
+    }
+
+    // Sorts clusters of the cache optimized order so that outward facing parts are drawn first and occlude
+    // the rest (view independent, after Sander et al.). Clusters start where the cache simulation misses all
+    // three vertices of a triangle, so their internal order is kept. The new order is dropped if it makes the
+    // ACMR worse by more than the given factor.
+    inline void OptimizeOverdraw(std::vector<unsigned int>& indices, const std::vector<Vertex>& vertices, float threshold)
+    {
+        const size_t triangleCount = indices.size() / 3;
+        if (triangleCount < 2)
+            return;
+
+        std::vector<size_t> clusterStart;
+        std::vector<unsigned int> timestamps(vertices.size(), 0);
+        const unsigned int cacheSize = 16;
+        unsigned int time = cacheSize + 1;
+        for (size_t t = 0; t < triangleCount; t++) {
+            int misses = 0;
+            for (int k = 0; k < 3; k++) {
+                unsigned int v = indices[t * 3 + k];
+                if (time - timestamps[v] > cacheSize) {
+                    timestamps[v] = time++;
+                    misses++;
+                }
+            }
+            if (t == 0 || misses == 3)
+                clusterStart.push_back(t);
+        }
+        if (clusterStart.size() < 2)
+            return;
+        clusterStart.push_back(triangleCount);
+
+        glm::vec3 meshCentroid(0.0f);
+        for (const Vertex& vertex : vertices)
+            meshCentroid += vertex.Position;
+        meshCentroid = meshCentroid / (float)std::max<size_t>(vertices.size(), 1);
+
+        struct Cluster {
+            size_t first, last;
+            float sortKey;
+        };
+        std::vector<Cluster> clusters;
+        for (size_t c = 0; c + 1 < clusterStart.size(); c++) {
+            glm::vec3 centroid(0.0f), normal(0.0f);
+            float area = 0.0f;
+            for (size_t t = clusterStart[c]; t < clusterStart[c + 1]; t++) {
+                glm::vec3 p0 = vertices[indices[t * 3]].Position;
+                glm::vec3 p1 = vertices[indices[t * 3 + 1]].Position;
+                glm::vec3 p2 = vertices[indices[t * 3 + 2]].Position;
+                glm::vec3 n = glm::cross(p1 - p0, p2 - p0);
+                float a = glm::length(n);
+                centroid += (p0 + p1 + p2) * (a / 3.0f);
+                normal += n;
+                area += a;
+            }
+            centroid = area > 0.0f ? centroid / area : vertices[indices[clusterStart[c] * 3]].Position;
+            float normalLength = glm::length(normal);
+            float key = normalLength > 0.0f ? glm::dot(centroid - meshCentroid, normal / normalLength) : 0.0f;
+            clusters.push_back(Cluster{clusterStart[c], clusterStart[c + 1], key});
+        }
+        std::stable_sort(clusters.begin(), clusters.end(),
+                         [](const Cluster& a, const Cluster& b) { return a.sortKey > b.sortKey; });
+
+        std::vector<unsigned int> sorted;
+        sorted.reserve(indices.size());
+        for (const Cluster& cluster : clusters)
+            sorted.insert(sorted.end(), indices.begin() + cluster.first * 3, indices.begin() + cluster.last * 3);
+        if (AnalyzeVertexCache(sorted, vertices.size()).acmr <= AnalyzeVertexCache(indices, vertices.size()).acmr * threshold)
+            indices.swap(sorted);
+    }
+
+    // Renumbers vertices in the order the index buffer first uses them, so vertex fetches walk memory
+    // forward. Vertices no triangle references are dropped.
+    inline void OptimizeVertexFetch(std::vector<Vertex>& vertices, std::vector<unsigned int>& indices,
+                                    std::vector<unsigned int>* vertexRemap = nullptr)
+    {
+        const unsigned int unused = std::numeric_limits<unsigned int>::max();
+        std::vector<unsigned int> remap(vertices.size(), unused);
+        std::vector<Vertex> reordered;
+        reordered.reserve(vertices.size());
+        for (unsigned int& index : indices) {
+            if (remap[index] == unused) {
+                remap[index] = (unsigned int)reordered.size();
+                reordered.push_back(vertices[index]);
+            }
+            index = remap[index];
+        }
+        vertices.swap(reordered);
+        if (vertexRemap)
+            vertexRemap->swap(remap);
+    }
+
+    struct MeshOptimizationStats {
+        VertexCacheStats before;
+        VertexCacheStats after;
+    };
+
+    // the whole import stage: cache order, then overdraw order (if enabled), then fetch order; vertexRemap
+    // receives the new index of every input vertex (max unsigned int for the dropped ones)
+    inline MeshOptimizationStats OptimizeMesh(std::vector<Vertex>& vertices, std::vector<unsigned int>& indices,
+                                              bool optimizeOverdraw = true, float overdrawThreshold = 1.05f,
+                                              std::vector<unsigned int>* vertexRemap = nullptr)
+    {
+        MeshOptimizationStats stats;
+        stats.before = AnalyzeVertexCache(indices, vertices.size());
+        OptimizeVertexCache(indices, vertices.size());
+        if (optimizeOverdraw)
+            OptimizeOverdraw(indices, vertices, overdrawThreshold);
+        OptimizeVertexFetch(vertices, indices, vertexRemap);
+        stats.after = AnalyzeVertexCache(indices, vertices.size());
+        return stats;
+    }
+}
+
+#endif //PROJECT_BASE_MESHOPTIMIZER_H
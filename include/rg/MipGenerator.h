@@ -0,0 +1,336 @@
+//
+// CPU mip chains for the loader threads: 2x2 box filter in linear light for sRGB color channels, optional
+// alpha coverage preservation for alpha tested / blended sprites, SSE2 where available.
+//
+
+#ifndef PROJECT_BASE_MIPGENERATOR_H
+#define PROJECT_BASE_MIPGENERATOR_H
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace rg {
+
+    struct MipLevel {
+        int width = 0;
+        int height = 0;
+        std::vector<unsigned char> pixels;
+    };
+
+    struct MipOptions {
+        // color channels hold sRGB encoded values and are averaged in linear light (alpha always is linear)
+        bool srgb = false;
+        // scale each level's alpha so the share of texels above alphaReference matches the top level
+        bool preserveAlphaCoverage = false;
+        float alphaReference = 0.5f;
+        // false runs the scalar reference filter
+        bool simd = true;
+    };
+
+    namespace detail {
+
+        const int LINEAR_TO_SRGB_STEPS = 4096;
+
+        struct MipTables {
+            float srgbToLinear[256];
+            float byteToLinear[256];
+            unsigned char linearToSrgb[LINEAR_TO_SRGB_STEPS];
+        };
+
+        inline const MipTables& mipTables()
+        {
+            static const MipTables tables = [] {
+                MipTables built;
+                for (int i = 0; i < 256; i++) {
+                    float value = i / 255.0f;
+                    built.byteToLinear[i] = i * (1.0f / 255.0f);  // bit exact with the SSE2 conversion
+                    built.srgbToLinear[i] = value <= 0.04045f ? value / 12.92f : std::pow((value + 0.055f) / 1.055f, 2.4f);
+                }
+                for (int i = 0; i < LINEAR_TO_SRGB_STEPS; i++) {
+                    float value = i / (float)(LINEAR_TO_SRGB_STEPS - 1);
+                    float encoded = value <= 0.0031308f ? value * 12.92f : 1.055f * std::pow(value, 1.0f / 2.4f) - 0.055f;
+                    built.linearToSrgb[i] = (unsigned char)std::min(255.0f, encoded * 255.0f + 0.5f);
+                }
+                return built;
+            }();
+            return tables;
+        }
+
+        inline bool isAlphaChannel(int channel, int components)
+        {
+            return (components == 2 && channel == 1) || (components == 4 && channel == 3);
+        }
+
+        // per channel: decode table, and whether encoding goes through linearToSrgb
+        struct ChannelCoding {
+            const float* decode[4];
+            bool srgb[4];
+            bool linear;  // no channel is sRGB
+        };
+
+        inline ChannelCoding channelCoding(int components, bool srgb)
+        {
+            const MipTables& tables = mipTables();
+            ChannelCoding coding;
+            coding.linear = !srgb;
+            for (int c = 0; c < 4; c++) {
+                coding.srgb[c] = srgb && !isAlphaChannel(c, components);
+                coding.decode[c] = coding.srgb[c] ? tables.srgbToLinear : tables.byteToLinear;
+            }
+            return coding;
+        }
+
+        inline unsigned char encodeChannel(float value, bool srgb)
+        {
+            value = std::min(1.0f, std::max(0.0f, value));
+            if (srgb)
+                return mipTables().linearToSrgb[(int)(value * (LINEAR_TO_SRGB_STEPS - 1) + 0.5f)];
+            return (unsigned char)(value * 255.0f + 0.5f);
+        }
+
+        // One level down. A dimension of 1 repeats its only row or column, an odd last row or column is dropped.
+        inline void downsampleScalar(const MipLevel& source, int components, const ChannelCoding& coding, MipLevel& target)
+        {
+            for (int y = 0; y < target.height; y++) {
+                const unsigned char* row0 = &source.pixels[(size_t)std::min(2 * y, source.height - 1) * source.width * components];
+                const unsigned char* row1 = &source.pixels[(size_t)std::min(2 * y + 1, source.height - 1) * source.width * components];
+                unsigned char* out = &target.pixels[(size_t)y * target.width * components];
+                for (int x = 0; x < target.width; x++) {
+                    int x0 = std::min(2 * x, source.width - 1) * components;
+                    int x1 = std::min(2 * x + 1, source.width - 1) * components;
+                    for (int c = 0; c < components; c++) {
+                        const float* decode = coding.decode[c];
+                        // same summation order as the SIMD path, so both produce identical bytes
+                        float sum = (decode[row0[x0 + c]] + decode[row1[x0 + c]]) + (decode[row0[x1 + c]] + decode[row1[x1 + c]]);
+                        out[x * components + c] = encodeChannel(sum * 0.25f, coding.srgb[c]);
+                    }
+                }
+            }
+        }
+
+#if defined(__SSE2__)
+        // 16 bytes to 16 floats in [0, 1]
+        inline void bytesToUnitFloats(const unsigned char* in, float* out)
+        {
+            const __m128i zero = _mm_setzero_si128();
+            const __m128 scale = _mm_set1_ps(1.0f / 255.0f);
+            __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in));
+            __m128i low = _mm_unpacklo_epi8(bytes, zero), high = _mm_unpackhi_epi8(bytes, zero);
+            _mm_storeu_ps(out, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(low, zero)), scale));
+            _mm_storeu_ps(out + 4, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(low, zero)), scale));
+            _mm_storeu_ps(out + 8, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(high, zero)), scale));
+            _mm_storeu_ps(out + 12, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(high, zero)), scale));
+        }
+
+        // decodes both rows, adds them and then neighbouring texels four floats at a time; the table lookups stay scalar
+        inline void downsampleSse2(const MipLevel& source, int components, const ChannelCoding& coding, MipLevel& target)
+        {
+            const MipTables& tables = mipTables();
+            size_t rowValues = (size_t)source.width * components;
+            // the vector loops run up to 8 texels past the row, single column images repeat their texel
+            size_t paddedValues = (size_t)std::max(source.width, 2) * components + 32;
+            std::vector<float> sum(paddedValues), row(paddedValues), half(paddedValues);
+            std::vector<int> indices(paddedValues), bytes(paddedValues);
+            const __m128 quarter = _mm_set1_ps(0.25f), zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f);
+            const __m128 srgbSteps = _mm_set1_ps((float)(LINEAR_TO_SRGB_STEPS - 1)), byteSteps = _mm_set1_ps(255.0f);
+            const __m128 rounding = _mm_set1_ps(0.5f);
+            size_t outValues = (size_t)target.width * components;
+
+            for (int y = 0; y < target.height; y++) {
+                const unsigned char* row0 = &source.pixels[(size_t)std::min(2 * y, source.height - 1) * rowValues];
+                const unsigned char* row1 = &source.pixels[(size_t)std::min(2 * y + 1, source.height - 1) * rowValues];
+                if (coding.linear) {
+                    size_t i = 0;
+                    for (; i + 16 <= rowValues; i += 16) {
+                        bytesToUnitFloats(row0 + i, &sum[i]);
+                        bytesToUnitFloats(row1 + i, &row[i]);
+                    }
+                    for (; i < rowValues; i++) {
+                        sum[i] = tables.byteToLinear[row0[i]];
+                        row[i] = tables.byteToLinear[row1[i]];
+                    }
+                } else {
+                    for (size_t i = 0; i < rowValues; i += components)
+                        for (int c = 0; c < components; c++) {
+                            sum[i + c] = coding.decode[c][row0[i + c]];
+                            row[i + c] = coding.decode[c][row1[i + c]];
+                        }
+                }
+                if (source.width == 1)
+                    for (int c = 0; c < components; c++) {
+                        sum[components + c] = sum[c];
+                        row[components + c] = row[c];
+                    }
+                size_t pairValues = (size_t)target.width * 2 * components;
+                for (size_t i = 0; i < pairValues; i += 4)
+                    _mm_storeu_ps(&sum[i], _mm_add_ps(_mm_loadu_ps(&sum[i]), _mm_loadu_ps(&row[i])));
+
+                // add each texel to its right neighbour
+                if (components == 4) {
+                    for (size_t i = 0; i < outValues; i += 4)
+                        _mm_storeu_ps(&half[i], _mm_add_ps(_mm_loadu_ps(&sum[2 * i]), _mm_loadu_ps(&sum[2 * i + 4])));
+                } else if (components == 2) {
+                    for (size_t i = 0; i < outValues; i += 4) {
+                        __m128 a = _mm_loadu_ps(&sum[2 * i]), b = _mm_loadu_ps(&sum[2 * i + 4]);
+                        _mm_storeu_ps(&half[i], _mm_add_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(1, 0, 1, 0)),
+                                                           _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 2, 3, 2))));
+                    }
+                } else if (components == 1) {
+                    for (size_t i = 0; i < outValues; i += 4) {
+                        __m128 a = _mm_loadu_ps(&sum[2 * i]), b = _mm_loadu_ps(&sum[2 * i + 4]);
+                        _mm_storeu_ps(&half[i], _mm_add_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)),
+                                                           _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1))));
+                    }
+                } else {
+                    for (int x = 0; x < target.width; x++)
+                        for (int c = 0; c < components; c++)
+                            half[x * components + c] = sum[2 * x * components + c] + sum[(2 * x + 1) * components + c];
+                }
+
+                // scale, clamp and turn into table indices or bytes
+                unsigned char* out = &target.pixels[(size_t)y * outValues];
+                if (coding.linear) {
+                    size_t i = 0;
+                    for (; i + 16 <= outValues; i += 16) {
+                        __m128i packed[4];
+                        for (int k = 0; k < 4; k++) {
+                            __m128 value = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(&half[i + 4 * k]), quarter), zero), one);
+                            packed[k] = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(value, byteSteps), rounding));
+                        }
+                        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i),
+                                         _mm_packus_epi16(_mm_packs_epi32(packed[0], packed[1]),
+                                                          _mm_packs_epi32(packed[2], packed[3])));
+                    }
+                    for (; i < outValues; i++)
+                        out[i] = encodeChannel(half[i] * 0.25f, false);
+                    continue;
+                }
+                for (size_t i = 0; i < outValues; i += 4) {
+                    __m128 value = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(&half[i]), quarter), zero), one);
+                    __m128i srgbIndex = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(value, srgbSteps), rounding));
+                    __m128i byte = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(value, byteSteps), rounding));
+                    _mm_storeu_si128(reinterpret_cast<__m128i*>(&indices[i]), srgbIndex);
+                    _mm_storeu_si128(reinterpret_cast<__m128i*>(&bytes[i]), byte);
+                }
+                for (size_t i = 0; i < outValues; i += components)
+                    for (int c = 0; c < components; c++)
+                        out[i + c] = coding.srgb[c] ? tables.linearToSrgb[indices[i + c]] : (unsigned char)bytes[i + c];
+            }
+        }
+#endif
+
+        inline float alphaCoverage(const MipLevel& level, int components, float reference)
+        {
+            int threshold = (int)(reference * 255.0f);
+            size_t texels = (size_t)level.width * level.height, covered = 0;
+            for (size_t i = 0; i < texels; i++)
+                covered += level.pixels[i * components + components - 1] > threshold;
+            return texels ? (float)covered / texels : 0.0f;
+        }
+
+        // binary search for the alpha scale that brings the level's coverage back to the top level's
+        inline void scaleAlphaToCoverage(MipLevel& level, int components, float reference, float coverage)
+        {
+            std::vector<unsigned char> original(level.pixels);
+            size_t texels = (size_t)level.width * level.height;
+            auto apply = [&](float scale) {
+                for (size_t i = 0; i < texels; i++) {
+                    size_t at = i * components + components - 1;
+                    level.pixels[at] = (unsigned char)std::min(255.0f, original[at] * scale + 0.5f);
+                }
+            };
+            float low = 0.0f, high = 4.0f, best = 1.0f, bestError = 2.0f;
+            for (int step = 0; step < 12; step++) {
+                float scale = 0.5f * (low + high);
+                apply(scale);
+                float levelCoverage = alphaCoverage(level, components, reference);
+                if (std::abs(levelCoverage - coverage) < bestError) {
+                    bestError = std::abs(levelCoverage - coverage);
+                    best = scale;
+                }
+                if (levelCoverage < coverage)
+                    low = scale;
+                else
+                    high = scale;
+            }
+            apply(best);
+        }
+    }
+
+    // Levels 1..n of an image down to 1x1, each filtered from the one above. Safe to call from any thread.
+    inline std::vector<MipLevel> GenerateMips(const unsigned char* pixels, int width, int height, int components,
+                                              const MipOptions& options = MipOptions())
+    {
+        std::vector<MipLevel> levels;
+        if (!pixels || width <= 0 || height <= 0 || components <= 0 || components > 4)
+            return levels;
+        detail::ChannelCoding coding = detail::channelCoding(components, options.srgb);
+        bool keepCoverage = options.preserveAlphaCoverage && (components == 2 || components == 4);
+
+        MipLevel top;
+        top.width = width;
+        top.height = height;
+        top.pixels.assign(pixels, pixels + (size_t)width * height * components);
+        float coverage = keepCoverage ? detail::alphaCoverage(top, components, options.alphaReference) : 0.0f;
+
+        const MipLevel* source = &top;
+        while (source->width > 1 || source->height > 1) {
+            MipLevel level;
+            level.width = std::max(1, source->width / 2);
+            level.height = std::max(1, source->height / 2);
+            level.pixels.resize((size_t)level.width * level.height * components);
+#if defined(__SSE2__)
+            if (options.simd)
+                detail::downsampleSse2(*source, components, coding, level);
+            else
+                detail::downsampleScalar(*source, components, coding, level);
+#else
+            detail::downsampleScalar(*source, components, coding, level);
+#endif
+            if (keepCoverage)
+                detail::scaleAlphaToCoverage(level, components, options.alphaReference, coverage);
+            levels.push_back(std::move(level));
+            source = &levels.back();
+        }
+        return levels;
+    }
+
+    struct MipBenchmarkResult {
+        double scalarMs = 0.0;  // per chain
+        double simdMs = 0.0;
+        size_t mismatchedBytes = 0;  // between the two chains, expected to be 0
+    };
+
+    // times the scalar reference against the SIMD filter on one image (--mip-benchmark)
+    inline MipBenchmarkResult BenchmarkMips(const unsigned char* pixels, int width, int height, int components,
+                                            unsigned int repetitions, bool srgb)
+    {
+        MipBenchmarkResult result;
+        MipOptions options;
+        options.srgb = srgb;
+        std::vector<MipLevel> chains[2];
+        double* times[2] = {&result.scalarMs, &result.simdMs};
+        repetitions = std::max(1u, repetitions);
+        for (int simd = 0; simd < 2; simd++) {
+            options.simd = simd == 1;
+            auto start = std::chrono::steady_clock::now();
+            for (unsigned int i = 0; i < repetitions; i++)
+                chains[simd] = GenerateMips(pixels, width, height, components, options);
+            *times[simd] = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count()
+                           / repetitions;
+        }
+        for (size_t level = 0; level < chains[0].size(); level++)
+            for (size_t i = 0; i < chains[0][level].pixels.size(); i++)
+                result.mismatchedBytes += chains[0][level].pixels[i] != chains[1][level].pixels[i];
+        return result;
+    }
+}
+
+#endif //PROJECT_BASE_MIPGENERATOR_H
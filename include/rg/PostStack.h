@@ -0,0 +1,82 @@
+//
+// Post-processing after bloom: every effect works on a single pixel, so the enabled ones are fused into
+// one full-screen pass drawn straight into the output framebuffer. One shader variant per effect set.
+//
+
+#ifndef PROJECT_BASE_POSTSTACK_H
+#define PROJECT_BASE_POSTSTACK_H
+
+#include <glad/glad.h>
+#include <learnopengl/shader.h>
+#include <rg/GLState.h>
+
+#include <map>
+#include <memory>
+#include <string>
+
+namespace rg {
+
+    // effect bits, in the order the effects are applied (see post.fs)
+    const unsigned int POST_BLOOM = 1u << 0;      // adds the blurred bright parts
+    const unsigned int POST_TONEMAP = 1u << 1;    // exposure tone mapping
+    const unsigned int POST_GAMMA = 1u << 2;
+    const unsigned int POST_GRAYSCALE = 1u << 3;
+
+    struct PostInputs {
+        unsigned int scene = 0;    // HDR color
+        unsigned int bloom = 0;    // only read with POST_BLOOM
+        float exposure = 1.0f;
+    };
+
+    class PostStack {
+    public:
+        void Init(const std::string& vertexPath, const std::string& fragmentPath)
+        {
+            this->vertexPath = vertexPath;
+            this->fragmentPath = fragmentPath;
+        }
+
+        // draws the effects into the bound framebuffer, the variant is compiled the first time it is used
+        void Render(unsigned int effects, const PostInputs& inputs, unsigned int quadVAO)
+        {
+            Shader& shader = variant(effects);
+            shader.use();
+            GLCache().BindTexture(0, GL_TEXTURE_2D, inputs.scene);
+            if (effects & POST_BLOOM)
+                GLCache().BindTexture(1, GL_TEXTURE_2D, inputs.bloom);
+            if (effects & POST_TONEMAP)
+                shader.setFloat("exposure"_uniform, inputs.exposure);
+            GLCache().BindVertexArray(quadVAO);
+            glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+        }
+
+    private:
+        std::string vertexPath;
+        std::string fragmentPath;
+        std::map<unsigned int, std::unique_ptr<Shader>> variants;
+
+        Shader& variant(unsigned int effects)
+        {
+            std::unique_ptr<Shader>& shader = variants[effects];
+            if (!shader) {
+                std::string defines;
+                if (effects & POST_BLOOM)
+                    defines += "#define BLOOM\n";
+                if (effects & POST_TONEMAP)
+                    defines += "#define TONEMAP\n";
+                if (effects & POST_GAMMA)
+                    defines += "#define GAMMA\n";
+                if (effects & POST_GRAYSCALE)
+                    defines += "#define GRAYSCALE\n";
+                shader.reset(new Shader(vertexPath.c_str(), fragmentPath.c_str(), nullptr, defines));
+                shader->use();
+                shader->setInt("scene", 0);
+                if (effects & POST_BLOOM)
+                    shader->setInt("bloomBlur", 1);
+            }
+            return *shader;
+        }
+    };
+}
+
+#endif //PROJECT_BASE_POSTSTACK_H
@@ -0,0 +1,271 @@
+//
+// Per-stage frame profiler: CPU time from steady_clock, GPU time from GL_TIME_ELAPSED queries that are
+// double buffered (read back when their slot comes around again) so the CPU never waits on them.
+//
+
+#ifndef PROJECT_BASE_PROFILER_H
+#define PROJECT_BASE_PROFILER_H
+
+#include <glad/glad.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace rg {
+
+    class Profiler {
+    public:
+        static const unsigned int FRAME_LATENCY = 2;
+        static const unsigned int HISTORY = 240;
+        // oldest trace events are dropped beyond this, roughly a minute of frames
+        static const size_t MAX_TRACE_EVENTS = 40000;
+
+        struct Stage {
+            std::string name;
+            // rolling history in milliseconds, written at historyPos
+            std::vector<float> cpuHistory = std::vector<float>(HISTORY, 0.0f);
+            std::vector<float> gpuHistory = std::vector<float>(HISTORY, 0.0f);
+            unsigned int historyPos = 0;
+            double cpuAverageMs = 0.0;
+            double gpuAverageMs = 0.0;
+
+            GLuint queries[FRAME_LATENCY] = {0};
+            bool pending[FRAME_LATENCY] = {false};
+            double cpuStartUs[FRAME_LATENCY] = {0.0};
+            unsigned long long frame[FRAME_LATENCY] = {0};
+        };
+
+        // complete per-frame record, only kept while RecordFrames is on
+        struct FrameTimes {
+            double cpuMs = 0.0;
+            // indexed like Stages(), 0 if the stage did not run (or its GPU result was dropped)
+            std::vector<float> stageCpuMs;
+            std::vector<float> stageGpuMs;
+        };
+
+        // block on query results instead of dropping the ones that are late, for benchmark runs
+        bool waitForResults = false;
+
+        Profiler() : epoch(std::chrono::steady_clock::now()) {}
+
+        void BeginFrame()
+        {
+            slot = frameIndex % FRAME_LATENCY;
+            // results of the frame that used this slot FRAME_LATENCY frames ago should be ready by now
+            for (Stage& stage : stages)
+                collect(stage, slot);
+            frameStartUs = nowUs();
+            if (recordFrames)
+                frames.emplace_back();
+        }
+
+        void EndFrame()
+        {
+            double durationUs = nowUs() - frameStartUs;
+            frameAverageMs = frameAverageMs * 0.95 + durationUs / 1000.0 * 0.05;
+            addEvent("frame", 0, frameStartUs, durationUs);
+            if (isRecorded(frameIndex))
+                frames.back().cpuMs = durationUs / 1000.0;
+            for (Stage& stage : stages) {
+                // a stage that does not run next frame (e.g. a disabled path) shows up as zero
+                stage.historyPos = (stage.historyPos + 1) % HISTORY;
+                stage.cpuHistory[stage.historyPos] = 0.0f;
+                stage.gpuHistory[stage.historyPos] = 0.0f;
+            }
+            frameIndex++;
+        }
+
+        // stages cannot be nested, GL_TIME_ELAPSED queries do not allow it
+        void Begin(const char* name)
+        {
+            current = &stageNamed(name);
+            if (current->queries[0] == 0)
+                glGenQueries(FRAME_LATENCY, current->queries);
+            current->cpuStartUs[slot] = nowUs();
+            current->frame[slot] = frameIndex;
+            glBeginQuery(GL_TIME_ELAPSED, current->queries[slot]);
+        }
+
+        void End()
+        {
+            glEndQuery(GL_TIME_ELAPSED);
+            current->pending[slot] = true;
+            double durationUs = nowUs() - current->cpuStartUs[slot];
+            current->cpuHistory[current->historyPos] = (float)(durationUs / 1000.0);
+            current->cpuAverageMs = average(current->cpuAverageMs, durationUs / 1000.0);
+            addEvent(current->name, 1, current->cpuStartUs[slot], durationUs);
+            if (isRecorded(frameIndex))
+                frameSample(frameIndex, *current).first = (float)(durationUs / 1000.0);
+            current = nullptr;
+        }
+
+        // waits for the GPU and collects every outstanding query, call after the last frame
+        void Flush()
+        {
+            glFinish();
+            for (unsigned int i = 0; i < FRAME_LATENCY; i++)
+                for (Stage& stage : stages)
+                    collect(stage, i);
+        }
+
+        // starts (and clears) or stops keeping FrameTimes of every frame, call between frames
+        void RecordFrames(bool enabled)
+        {
+            recordFrames = enabled;
+            if (enabled) {
+                frames.clear();
+                firstRecordedFrame = frameIndex;
+            }
+        }
+        const std::vector<FrameTimes>& Frames() const { return frames; }
+
+        const std::vector<Stage>& Stages() const { return stages; }
+        double FrameAverageMs() const { return frameAverageMs; }
+
+        // averaged GPU time of a stage, 0 if it never ran
+        double GpuMs(const char* name) const
+        {
+            for (const Stage& stage : stages)
+                if (stage.name == name)
+                    return stage.gpuAverageMs;
+            return 0.0;
+        }
+
+        // writes the recorded events in the Chrome trace event format (chrome://tracing, Perfetto)
+        bool ExportChromeTrace(const std::string& path) const
+        {
+            std::ofstream out(path);
+            if (!out) {
+                std::cout << "ERROR::PROFILER::CANNOT_WRITE " << path << std::endl;
+                return false;
+            }
+            out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+            out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":1,\"args\":{\"name\":\"CPU\"}},\n";
+            out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":2,\"args\":{\"name\":\"GPU\"}},\n";
+            out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":0,\"args\":{\"name\":\"Frame\"}}";
+            for (const TraceEvent& event : events) {
+                out << ",\n{\"name\":\"" << jsonEscaped(event.name) << "\",\"ph\":\"X\",\"pid\":0,\"tid\":" << event.track
+                    << ",\"ts\":" << event.startUs << ",\"dur\":" << event.durationUs << "}";
+            }
+            out << "\n]}\n";
+            return (bool)out;
+        }
+
+    private:
+        struct TraceEvent {
+            std::string name;
+            int track; // 0 frame, 1 CPU, 2 GPU
+            double startUs;
+            double durationUs;
+        };
+
+        std::vector<Stage> stages;
+        Stage* current = nullptr;
+        unsigned long long frameIndex = 0;
+        unsigned int slot = 0;
+        double frameStartUs = 0.0;
+        double frameAverageMs = 0.0;
+        std::chrono::steady_clock::time_point epoch;
+        std::deque<TraceEvent> events;
+        bool recordFrames = false;
+        unsigned long long firstRecordedFrame = 0;
+        std::vector<FrameTimes> frames;
+
+        double nowUs() const
+        {
+            return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - epoch).count();
+        }
+
+        static double average(double average, double sample)
+        {
+            return average == 0.0 ? sample : average * 0.95 + sample * 0.05;
+        }
+
+        Stage& stageNamed(const char* name)
+        {
+            for (Stage& stage : stages)
+                if (stage.name == name)
+                    return stage;
+            // stages are only ever appended, references stay valid until the next new stage
+            stages.emplace_back();
+            stages.back().name = name;
+            return stages.back();
+        }
+
+        void collect(Stage& stage, unsigned int slot)
+        {
+            if (!stage.pending[slot])
+                return;
+            stage.pending[slot] = false;
+            GLint available = 0;
+            if (!waitForResults)
+                glGetQueryObjectiv(stage.queries[slot], GL_QUERY_RESULT_AVAILABLE, &available);
+            if (!waitForResults && !available) // GPU is running more than FRAME_LATENCY frames behind, drop the sample
+                return;
+            GLuint64 elapsed = 0;
+            glGetQueryObjectui64v(stage.queries[slot], GL_QUERY_RESULT, &elapsed);
+            double ms = elapsed / 1.0e6;
+            // the sample belongs to an older frame, record it where that frame's CPU time went
+            unsigned int pos = (stage.historyPos + HISTORY - (unsigned int)(frameIndex - stage.frame[slot]) % HISTORY) % HISTORY;
+            stage.gpuHistory[pos] = (float)ms;
+            stage.gpuAverageMs = average(stage.gpuAverageMs, ms);
+            // the GPU has no common clock with the CPU here, line the event up with the CPU submission
+            addEvent(stage.name, 2, stage.cpuStartUs[slot], ms * 1000.0);
+            if (isRecorded(stage.frame[slot]))
+                frameSample(stage.frame[slot], stage).second = (float)ms;
+        }
+
+        bool isRecorded(unsigned long long frame) const
+        {
+            return frame >= firstRecordedFrame && frame - firstRecordedFrame < frames.size();
+        }
+
+        // (cpu, gpu) entry of a stage in the record of the given frame
+        std::pair<float&, float&> frameSample(unsigned long long frame, const Stage& stage)
+        {
+            FrameTimes& times = frames[frame - firstRecordedFrame];
+            size_t index = &stage - stages.data();
+            if (times.stageCpuMs.size() <= index) {
+                times.stageCpuMs.resize(index + 1, 0.0f);
+                times.stageGpuMs.resize(index + 1, 0.0f);
+            }
+            return std::pair<float&, float&>(times.stageCpuMs[index], times.stageGpuMs[index]);
+        }
+
+        // name as the contents of a JSON string: quotes, backslashes and control characters escaped
+        static std::string jsonEscaped(const std::string& name)
+        {
+            std::string escaped;
+            escaped.reserve(name.size());
+            for (char c : name) {
+                if (c == '"' || c == '\\') {
+                    escaped += '\\';
+                    escaped += c;
+                } else if ((unsigned char)c < 0x20) {
+                    char code[8];
+                    std::snprintf(code, sizeof(code), "\\u%04x", (unsigned int)(unsigned char)c);
+                    escaped += code;
+                } else {
+                    escaped += c;
+                }
+            }
+            return escaped;
+        }
+
+        void addEvent(const std::string& name, int track, double startUs, double durationUs)
+        {
+            events.push_back(TraceEvent{name, track, startUs, durationUs});
+            if (events.size() > MAX_TRACE_EVENTS)
+                events.pop_front();
+        }
+    };
+}
+
+#endif //PROJECT_BASE_PROFILER_H
@@ -0,0 +1,170 @@
+//
+// Render queue: every draw of the frame is submitted with a 64-bit sort key (pass, shader, material, VAO,
+// depth), the keys are radix sorted and the draws executed in that order, changing program, material and
+// VAO only when the next draw needs a different one.
+//
+
+#ifndef PROJECT_BASE_RENDERQUEUE_H
+#define PROJECT_BASE_RENDERQUEUE_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <learnopengl/shader.h>
+#include <rg/GLState.h>
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+namespace rg {
+
+    struct RenderQueueStats {
+        unsigned int draws = 0;
+        unsigned int programSwitches = 0;
+        unsigned int materialSwitches = 0;  // texture binding changes
+        unsigned int vaoSwitches = 0;
+    };
+
+    class RenderQueue {
+    public:
+        typedef std::function<void()> Callback;
+
+        // Passes run in increasing order; setup is called on entering the pass (blending, culling, ...).
+        // Back to front passes sort by depth before anything else, the others by state and then front to back.
+        void SetPass(unsigned int pass, Callback setup, bool backToFront = false)
+        {
+            if (passes.size() <= pass)
+                passes.resize(pass + 1);
+            passes[pass] = Pass{setup, backToFront};
+        }
+
+        // small ids for the sort keys, register everything once at startup
+        unsigned int RegisterShader(Shader& shader)
+        {
+            shaders.push_back(&shader);
+            return (unsigned int)shaders.size() - 1;
+        }
+
+        // bind makes the material's textures current
+        unsigned int RegisterMaterial(Callback bind)
+        {
+            materials.push_back(bind);
+            return (unsigned int)materials.size() - 1;
+        }
+
+        void Clear()
+        {
+            items.clear();
+            entries.clear();
+        }
+
+        // depth is the view distance divided by the far plane; draw issues the draw calls with the state bound
+        void Submit(unsigned int pass, unsigned int shader, unsigned int material, unsigned int vao, float depth,
+                    const glm::mat4& model, Callback draw)
+        {
+            items.push_back(Item{pass, shader, material, vao, model, draw});
+            entries.push_back(SortEntry{MakeKey(pass, shader, material, vao, depth), (uint32_t)entries.size()});
+        }
+
+        // sorts and runs the submitted draws; the queue stays filled until Clear
+        void Execute()
+        {
+            stats = RenderQueueStats();
+            sortEntries();
+            int currentPass = -1, currentShader = -1, currentMaterial = -1;
+            unsigned int currentVao = 0;
+            bool vaoKnown = false;
+            for (const SortEntry& entry : entries) {
+                const Item& item = items[entry.index];
+                if ((int)item.pass != currentPass) {
+                    currentPass = (int)item.pass;
+                    if (item.pass < passes.size() && passes[item.pass].setup)
+                        passes[item.pass].setup();
+                }
+                Shader& shader = *shaders[item.shader];
+                if ((int)item.shader != currentShader) {
+                    shader.use();
+                    currentShader = (int)item.shader;
+                    stats.programSwitches++;
+                }
+                if ((int)item.material != currentMaterial) {
+                    materials[item.material]();
+                    currentMaterial = (int)item.material;
+                    stats.materialSwitches++;
+                }
+                if (!vaoKnown || item.vao != currentVao) {
+                    GLCache().BindVertexArray(item.vao);
+                    currentVao = item.vao;
+                    vaoKnown = true;
+                    stats.vaoSwitches++;
+                }
+                shader.setMat4("model"_uniform, item.model);
+                item.draw();
+                stats.draws++;
+            }
+        }
+
+        const RenderQueueStats& Stats() const { return stats; }
+
+        // 4 bits pass | 8 bits shader | 16 bits material | 12 bits VAO | 24 bits depth, or for back to front
+        // passes 4 bits pass | 24 bits inverted depth | 8 bits shader | 16 bits material | 12 bits VAO.
+        // Ids wider than their field only weaken the grouping, Execute compares the real values.
+        uint64_t MakeKey(unsigned int pass, unsigned int shader, unsigned int material, unsigned int vao, float depth) const
+        {
+            uint64_t depthBits = (uint64_t)(glm::clamp(depth, 0.0f, 1.0f) * 16777215.0f);
+            uint64_t state = ((uint64_t)(shader & 0xffu) << 28) | ((uint64_t)(material & 0xffffu) << 12) | (vao & 0xfffu);
+            uint64_t key = (uint64_t)(pass & 0xfu) << 60;
+            if (pass < passes.size() && passes[pass].backToFront)
+                return key | ((0xffffffu - depthBits) << 36) | state;
+            return key | (state << 24) | depthBits;
+        }
+
+    private:
+        struct Pass {
+            Callback setup;
+            bool backToFront = false;
+        };
+
+        struct Item {
+            unsigned int pass, shader, material, vao;
+            glm::mat4 model;
+            Callback draw;
+        };
+
+        struct SortEntry {
+            uint64_t key;
+            uint32_t index;
+        };
+
+        std::vector<Pass> passes;
+        std::vector<Shader*> shaders;
+        std::vector<Callback> materials;
+        std::vector<Item> items;
+        std::vector<SortEntry> entries, scratch;
+        RenderQueueStats stats;
+
+        // LSD radix sort over the key bytes, stable, skipping bytes every key has in common
+        void sortEntries()
+        {
+            scratch.resize(entries.size());
+            for (unsigned int shift = 0; shift < 64; shift += 8) {
+                size_t counts[256] = {0};
+                for (const SortEntry& entry : entries)
+                    counts[(entry.key >> shift) & 0xffu]++;
+                if (entries.empty() || counts[(entries[0].key >> shift) & 0xffu] == entries.size())
+                    continue;
+                size_t offset = 0;
+                for (size_t& count : counts) {
+                    size_t next = offset + count;
+                    count = offset;
+                    offset = next;
+                }
+                for (const SortEntry& entry : entries)
+                    scratch[counts[(entry.key >> shift) & 0xffu]++] = entry;
+                entries.swap(scratch);
+            }
+        }
+    };
+}
+
+#endif //PROJECT_BASE_RENDERQUEUE_H
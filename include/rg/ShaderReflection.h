@@ -0,0 +1,91 @@
+//
+// Which material maps a shader program samples, read from its active uniforms after linking, so a model only
+// decodes and uploads the maps the shader it is drawn with consumes.
+//
+
+#ifndef PROJECT_BASE_SHADERREFLECTION_H
+#define PROJECT_BASE_SHADERREFLECTION_H
+
+#include <glad/glad.h>
+
+#include <cctype>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace rg {
+
+    // map types the material buffer (rg::GpuMaterial) carries to shaders that read materialData
+    const char* const MATERIAL_BUFFER_MAP_TYPES[] = {"texture_diffuse", "texture_specular"};
+
+    class TextureUsage {
+    public:
+        // every map type, for loading without a shader at hand
+        static TextureUsage All()
+        {
+            TextureUsage usage;
+            usage.all = true;
+            return usage;
+        }
+
+        // Reflects the active uniforms of a linked program: a map type is used if a sampler named after it is
+        // active (texture_diffuseN, the per-mesh sampler convention) or, for the map types of the material buffer,
+        // if materialData is. Uniforms the compiler removed because nothing reads them are not active.
+        static TextureUsage FromProgram(unsigned int program)
+        {
+            TextureUsage usage;
+            GLint count = 0, maxLength = 0;
+            glGetProgramiv(program, GL_ACTIVE_UNIFORMS, &count);
+            glGetProgramiv(program, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+            std::vector<char> name((size_t)maxLength + 1, '\0');
+            for (GLint i = 0; i < count; i++) {
+                GLsizei length = 0;
+                GLint size = 0;
+                GLenum type = 0;
+                glGetActiveUniform(program, (GLuint)i, (GLsizei)name.size(), &length, &size, &type, name.data());
+                std::string uniform(name.data(), (size_t)length);
+                if (uniform == "materialData") {
+                    for (const char* mapType : MATERIAL_BUFFER_MAP_TYPES)
+                        usage.types.insert(mapType);
+                } else if (uniform.compare(0, 8, "texture_") == 0) {
+                    // texture_diffuse1 or texture_normal[0] is a map of type texture_diffuse or texture_normal
+                    size_t end = uniform.find('[');
+                    end = end == std::string::npos ? uniform.size() : end;
+                    while (end > 0 && std::isdigit((unsigned char)uniform[end - 1]))
+                        end--;
+                    usage.types.insert(uniform.substr(0, end));
+                }
+            }
+            return usage;
+        }
+
+        bool Uses(const std::string& type) const
+        {
+            return all || types.count(type) > 0;
+        }
+
+        // the maps either usage needs, e.g. of every shader variant a model is drawn with
+        void Add(const TextureUsage& other)
+        {
+            all = all || other.all;
+            types.insert(other.types.begin(), other.types.end());
+        }
+
+        // the used map types, for logs
+        std::string Describe() const
+        {
+            if (all)
+                return "all maps";
+            std::string description;
+            for (const std::string& type : types)
+                description += (description.empty() ? "" : ", ") + type;
+            return description.empty() ? "no maps" : description;
+        }
+
+    private:
+        bool all = false;
+        std::set<std::string> types;
+    };
+}
+
+#endif //PROJECT_BASE_SHADERREFLECTION_H
@@ -0,0 +1,144 @@
+//
+// Static batching done once at load: meshes with the same material and a single placement are merged into one
+// mesh with their vertices baked into model space, so the whole group is drawn by one command. Every merged mesh
+// stays a run of the batch's indices with bounds of its own and is still culled on its own.
+//
+
+#ifndef PROJECT_BASE_STATICBATCHING_H
+#define PROJECT_BASE_STATICBATCHING_H
+
+#include <learnopengl/mesh.h>
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace rg {
+
+    struct StaticBatchStats {
+        unsigned int meshesBefore = 0;
+        unsigned int meshesAfter = 0;
+        // DrawCommandCount of the meshes
+        unsigned int drawsBefore = 0;
+        unsigned int drawsAfter = 0;
+    };
+
+    // indirect commands the meshes take per frame with nothing culled
+    inline unsigned int DrawCommandCount(const std::vector<Mesh>& meshes)
+    {
+        unsigned int draws = 0;
+        for (const Mesh& mesh : meshes)
+            draws += (unsigned int)mesh.indexRanges.size();
+        return draws;
+    }
+
+    namespace detail {
+
+        // types and paths of the textures, the identity of a material; all meshes of a model share one shader
+        inline std::vector<std::pair<std::string, std::string>> materialKey(const Mesh& mesh)
+        {
+            std::vector<std::pair<std::string, std::string>> key;
+            for (const Texture& texture : mesh.textures)
+                key.push_back(std::make_pair(texture.type, texture.path));
+            return key;
+        }
+
+        // the vertices of a mesh placed by transform, appended to a batch as one more sub mesh
+        inline void appendToBatch(const Mesh& mesh, const glm::mat4& transform, std::vector<Vertex>& vertices,
+                                  std::vector<unsigned int>& indices, std::vector<SubMesh>& subMeshes)
+        {
+            const glm::mat3 basis(transform);
+            const glm::mat3 normalMatrix = glm::transpose(glm::inverse(basis));
+            const unsigned int baseVertex = (unsigned int)vertices.size();
+            SubMesh subMesh;
+            subMesh.firstIndex = (unsigned int)indices.size();
+            subMesh.indexCount = (unsigned int)mesh.indices.size();
+            subMesh.aabbMin = subMesh.aabbMax = glm::vec3(transform * glm::vec4(mesh.vertices.empty()
+                    ? glm::vec3(0.0f) : mesh.vertices[0].Position, 1.0f));
+            for (Vertex vertex : mesh.vertices) {
+                vertex.Position = glm::vec3(transform * glm::vec4(vertex.Position, 1.0f));
+                vertex.Normal = normalMatrix * vertex.Normal;
+                vertex.Tangent = basis * vertex.Tangent;
+                vertex.Bitangent = basis * vertex.Bitangent;
+                subMesh.aabbMin = glm::min(subMesh.aabbMin, vertex.Position);
+                subMesh.aabbMax = glm::max(subMesh.aabbMax, vertex.Position);
+                vertices.push_back(vertex);
+            }
+            glm::vec3 center = (subMesh.aabbMin + subMesh.aabbMax) * 0.5f;
+            float radius2 = 0.0f;
+            for (size_t i = baseVertex; i < vertices.size(); i++) {
+                glm::vec3 d = vertices[i].Position - center;
+                radius2 = std::max(radius2, glm::dot(d, d));
+            }
+            subMesh.boundingRadius = std::sqrt(radius2);
+            for (unsigned int index : mesh.indices)
+                indices.push_back(baseVertex + index);
+            subMeshes.push_back(subMesh);
+        }
+    }
+
+    // Merges each group of two or more meshes with the same textures into one mesh that takes the place of the
+    // group's first member, and frees the arena space of the originals. Meshes drawn as several instances (or with
+    // texture coordinates per instance) are left alone, they already draw every copy with one command. Packed
+    // positions of a batch are quantized over the whole batch, coarser than over each original mesh.
+    inline StaticBatchStats BatchStaticMeshes(std::vector<Mesh>& meshes)
+    {
+        StaticBatchStats stats;
+        stats.meshesBefore = (unsigned int)meshes.size();
+        stats.drawsBefore = DrawCommandCount(meshes);
+
+        std::map<std::vector<std::pair<std::string, std::string>>, size_t> groupIndices;
+        std::vector<std::vector<size_t>> groups;
+        for (size_t i = 0; i < meshes.size(); i++) {
+            const Mesh& mesh = meshes[i];
+            if (mesh.instances.size() != 1 || !mesh.instanceTexCoords.empty() || !mesh.subMeshes.empty())
+                continue;
+            auto inserted = groupIndices.insert(std::make_pair(detail::materialKey(mesh), groups.size()));
+            if (inserted.second)
+                groups.emplace_back();
+            groups[inserted.first->second].push_back(i);
+        }
+
+        // the batch every merged mesh went into, -1 for meshes kept as they are
+        std::vector<int> batchOf(meshes.size(), -1);
+        std::vector<Mesh> batches;
+        for (const std::vector<size_t>& group : groups) {
+            if (group.size() < 2)
+                continue;
+            std::vector<Vertex> vertices;
+            std::vector<unsigned int> indices;
+            std::vector<SubMesh> subMeshes;
+            for (size_t i : group) {
+                Mesh& mesh = meshes[i];
+                detail::appendToBatch(mesh, mesh.instances[0].transform, vertices, indices, subMeshes);
+                Mesh::Arena(mesh.vertexFormat).Free(mesh.allocation);
+                batchOf[i] = (int)batches.size();
+            }
+            const Mesh& first = meshes[group[0]];
+            batches.emplace_back(std::move(vertices), std::move(indices), first.textures, first.vertexFormat);
+            batches.back().subMeshes = std::move(subMeshes);
+        }
+
+        std::vector<Mesh> result;
+        result.reserve(meshes.size());
+        std::vector<bool> placed(batches.size(), false);
+        for (size_t i = 0; i < meshes.size(); i++) {
+            if (batchOf[i] < 0)
+                result.push_back(std::move(meshes[i]));
+            else if (!placed[batchOf[i]]) {
+                result.push_back(std::move(batches[batchOf[i]]));
+                placed[batchOf[i]] = true;
+            }
+        }
+        meshes.swap(result);
+
+        stats.meshesAfter = (unsigned int)meshes.size();
+        stats.drawsAfter = DrawCommandCount(meshes);
+        return stats;
+    }
+}
+
+#endif //PROJECT_BASE_STATICBATCHING_H
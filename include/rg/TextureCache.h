@@ -0,0 +1,165 @@
+//
+// Cooked textures: the block compressed mip chain of an image, written next to it the first time the image is
+// loaded and read back instead of decoding and encoding it again while the source is unchanged.
+//
+
+#ifndef PROJECT_BASE_TEXTURECACHE_H
+#define PROJECT_BASE_TEXTURECACHE_H
+
+#include <rg/Hash.h>
+#include <rg/TextureCompression.h>
+#include <rg/TextureReduction.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace rg {
+
+    // bump whenever the layout below or the encoder output changes
+    // 2: mips filtered on the CPU (MipGenerator.h), sRGB images in linear light
+    // 3: constant and smooth images reduced before compression (TextureReduction.h)
+    const uint32_t TEXTURE_CACHE_VERSION = 3;
+    const char TEXTURE_CACHE_MAGIC[4] = {'R', 'G', 'T', 'C'};
+
+    // On-disk layout:
+    //   TextureCacheHeader
+    //   TextureCacheLevel[levelCount]
+    //   block data of every level back to back, ready for glCompressedTexSubImage*
+    struct TextureCacheHeader {
+        char magic[4];
+        uint32_t version;
+        uint64_t sourceHash;
+        uint32_t format;
+        uint32_t width;
+        uint32_t height;
+        uint32_t components;
+        uint32_t levelCount;
+        uint32_t srgb;  // mips averaged as sRGB colors
+        uint64_t dataSize;
+        uint32_t reduce;         // ReduceImage ran before compression
+        uint32_t droppedLevels;  // ImageReduction of the image
+        uint32_t constant;
+        uint8_t constantColor[4];
+    };
+
+    struct TextureCacheLevel {
+        uint32_t width;
+        uint32_t height;
+        uint64_t offset;  // from the start of the block data
+        uint64_t size;
+    };
+
+    // Reads a cooked image, false if the file is missing, damaged, made from another source or in a format
+    // this context would not pick for the image (e.g. BC1 cooked on a machine with S3TC, loaded on one without).
+    // reduce asks for an image cooked after ReduceImage, whose result comes back in reduction.
+    inline bool ReadTextureCache(const std::string& path, uint64_t sourceHash, bool srgb, bool reduce,
+                                 CompressedImage& image, ImageReduction& reduction)
+    {
+        std::ifstream in(path, std::ios::binary);
+        if (!in)
+            return false;
+        TextureCacheHeader header;
+        if (!in.read(reinterpret_cast<char*>(&header), sizeof(header))
+            || std::memcmp(header.magic, TEXTURE_CACHE_MAGIC, sizeof(header.magic)) != 0
+            || header.version != TEXTURE_CACHE_VERSION
+            || header.sourceHash != sourceHash
+            || header.srgb != (srgb ? 1u : 0u)
+            || header.reduce != (reduce ? 1u : 0u)
+            || header.format == 0 || header.format != CompressedFormatFor((int)header.components)
+            || header.levelCount == 0 || header.levelCount > 32)
+            return false;
+
+        std::vector<TextureCacheLevel> levels(header.levelCount);
+        if (!in.read(reinterpret_cast<char*>(levels.data()), levels.size() * sizeof(TextureCacheLevel)))
+            return false;
+        // the data must be what is left of the file, checked before it is allocated
+        std::streamoff dataStart = in.tellg();
+        in.seekg(0, std::ios::end);
+        std::streamoff fileEnd = in.tellg();
+        in.seekg(dataStart);
+        if (dataStart < 0 || fileEnd < dataStart || header.dataSize != (uint64_t)(fileEnd - dataStart))
+            return false;
+
+        CompressedImage result;
+        result.format = header.format;
+        result.width = (int)header.width;
+        result.height = (int)header.height;
+        result.components = (int)header.components;
+        // a full chain: level 0 of the header's size, each further level halved, down to 1x1
+        uint32_t width = header.width, height = header.height;
+        for (const TextureCacheLevel& level : levels) {
+            if (level.width != width || level.height != height
+                || level.size > header.dataSize || level.offset > header.dataSize - level.size
+                || level.size != CompressedLevelBytes(header.format, (int)level.width, (int)level.height))
+                return false;
+            width = std::max(1u, width / 2);
+            height = std::max(1u, height / 2);
+            CompressedLevel info;
+            info.width = (int)level.width;
+            info.height = (int)level.height;
+            info.offset = (size_t)level.offset;
+            info.size = (size_t)level.size;
+            result.levels.push_back(info);
+        }
+        if (levels.back().width != 1 || levels.back().height != 1)
+            return false;
+        result.data.resize((size_t)header.dataSize);
+        if (!in.read(reinterpret_cast<char*>(result.data.data()), result.data.size()))
+            return false;
+        image = std::move(result);
+        reduction.constant = header.constant != 0;
+        std::memcpy(reduction.color, header.constantColor, sizeof(reduction.color));
+        reduction.droppedLevels = (int)header.droppedLevels;
+        return true;
+    }
+
+    // Written to a temporary file first and renamed, so a crash halfway through never leaves a truncated cache.
+    inline bool WriteTextureCache(const std::string& path, uint64_t sourceHash, bool srgb, bool reduce,
+                                  const CompressedImage& image, const ImageReduction& reduction)
+    {
+        TextureCacheHeader header;
+        std::memcpy(header.magic, TEXTURE_CACHE_MAGIC, sizeof(header.magic));
+        header.version = TEXTURE_CACHE_VERSION;
+        header.sourceHash = sourceHash;
+        header.format = image.format;
+        header.width = (uint32_t)image.width;
+        header.height = (uint32_t)image.height;
+        header.components = (uint32_t)image.components;
+        header.levelCount = (uint32_t)image.levels.size();
+        header.srgb = srgb ? 1 : 0;
+        header.dataSize = image.data.size();
+        header.reduce = reduce ? 1 : 0;
+        header.droppedLevels = (uint32_t)reduction.droppedLevels;
+        header.constant = reduction.constant ? 1 : 0;
+        std::memcpy(header.constantColor, reduction.color, sizeof(header.constantColor));
+        std::vector<TextureCacheLevel> levels;
+        for (const CompressedLevel& info : image.levels)
+            levels.push_back(TextureCacheLevel{(uint32_t)info.width, (uint32_t)info.height, info.offset, info.size});
+
+        std::string tmpPath = path + ".tmp";
+        std::ofstream out(tmpPath, std::ios::binary | std::ios::trunc);
+        if (!out) {
+            std::cout << "ERROR::TEXTURE_CACHE::CANNOT_WRITE " << tmpPath << std::endl;
+            return false;
+        }
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char*>(levels.data()), levels.size() * sizeof(TextureCacheLevel));
+        out.write(reinterpret_cast<const char*>(image.data.data()), image.data.size());
+        out.close();
+        if (!out || std::rename(tmpPath.c_str(), path.c_str()) != 0) {
+            std::cout << "ERROR::TEXTURE_CACHE::CANNOT_WRITE " << path << std::endl;
+            std::remove(tmpPath.c_str());
+            return false;
+        }
+        return true;
+    }
+}
+
+#endif //PROJECT_BASE_TEXTURECACHE_H
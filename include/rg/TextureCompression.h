@@ -0,0 +1,363 @@
+//
+// CPU block compression of textures: BC1 for RGB, BC3 for RGBA, BC4 for one and BC5 for two channel images.
+// Every level of the mip chain (MipGenerator.h) is encoded here, so compressed textures are uploaded level by
+// level and never go through glGenerateMipmap.
+//
+
+#ifndef PROJECT_BASE_TEXTURECOMPRESSION_H
+#define PROJECT_BASE_TEXTURECOMPRESSION_H
+
+#include <glad/glad.h>
+#include <rg/MipGenerator.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+namespace rg {
+
+    // EXT_texture_compression_s3tc and its sRGB variants (EXT_texture_sRGB), not part of the GL 3.3 glad loader.
+    // RGTC (BC4/BC5) is core since GL 3.0.
+    const GLenum COMPRESSED_RGB_S3TC_DXT1 = 0x83F0;
+    const GLenum COMPRESSED_RGBA_S3TC_DXT5 = 0x83F3;
+    const GLenum COMPRESSED_SRGB_S3TC_DXT1 = 0x8C4C;
+    const GLenum COMPRESSED_SRGB_ALPHA_S3TC_DXT5 = 0x8C4F;
+
+    struct S3tcSupport {
+        bool formats = false;
+        bool srgbFormats = false;
+    };
+
+    inline S3tcSupport& S3tcSupportFlags()
+    {
+        static S3tcSupport support;
+        return support;
+    }
+
+    // Looks for EXT_texture_compression_s3tc, without it RGB and RGBA images stay uncompressed.
+    // Call on the GL thread before the first model is loaded.
+    inline bool DetectS3tc()
+    {
+        GLint extensionCount = 0;
+        glGetIntegerv(GL_NUM_EXTENSIONS, &extensionCount);
+        S3tcSupport support;
+        for (GLint i = 0; i < extensionCount; i++) {
+            const char* extension = (const char*)glGetStringi(GL_EXTENSIONS, i);
+            if (!extension)
+                continue;
+            if (std::strcmp(extension, "GL_EXT_texture_compression_s3tc") == 0)
+                support.formats = true;
+            else if (std::strcmp(extension, "GL_EXT_texture_sRGB") == 0
+                     || std::strcmp(extension, "GL_EXT_texture_compression_s3tc_srgb") == 0)
+                support.srgbFormats = true;
+        }
+        support.srgbFormats = support.srgbFormats && support.formats;
+        S3tcSupportFlags() = support;
+        return support.formats;
+    }
+
+    inline bool S3tcSupported()
+    {
+        return S3tcSupportFlags().formats;
+    }
+
+    // the internal format that makes GL decode the blocks from sRGB, format itself where there is none
+    inline GLenum SrgbCompressedFormat(GLenum format)
+    {
+        if (!S3tcSupportFlags().srgbFormats)
+            return format;
+        if (format == COMPRESSED_RGB_S3TC_DXT1)
+            return COMPRESSED_SRGB_S3TC_DXT1;
+        if (format == COMPRESSED_RGBA_S3TC_DXT5)
+            return COMPRESSED_SRGB_ALPHA_S3TC_DXT5;
+        return format;
+    }
+
+    // the block format images with this many channels are compressed to, 0 if they are uploaded as they are
+    inline GLenum CompressedFormatFor(int components)
+    {
+        switch (components) {
+            case 1: return GL_COMPRESSED_RED_RGTC1;
+            case 2: return GL_COMPRESSED_RG_RGTC2;
+            case 3: return S3tcSupported() ? COMPRESSED_RGB_S3TC_DXT1 : 0;
+            case 4: return S3tcSupported() ? COMPRESSED_RGBA_S3TC_DXT5 : 0;
+            default: return 0;
+        }
+    }
+
+    // bytes per 4x4 block
+    inline unsigned int CompressedBlockBytes(GLenum format)
+    {
+        return format == COMPRESSED_RGB_S3TC_DXT1 || format == GL_COMPRESSED_RED_RGTC1 ? 8 : 16;
+    }
+
+    // levels smaller than a block still take a whole block
+    inline size_t CompressedLevelBytes(GLenum format, int width, int height)
+    {
+        return (size_t)((width + 3) / 4) * (size_t)((height + 3) / 4) * CompressedBlockBytes(format);
+    }
+
+    struct CompressedLevel {
+        int width = 0;
+        int height = 0;
+        size_t offset = 0;  // into CompressedImage::data
+        size_t size = 0;
+    };
+
+    struct CompressedImage {
+        GLenum format = 0;
+        int width = 0;
+        int height = 0;
+        int components = 0;  // of the source image
+        std::vector<CompressedLevel> levels;  // level 0 first, down to 1x1
+        std::vector<unsigned char> data;
+    };
+
+    namespace detail {
+
+        inline uint16_t packRgb565(const float color[3])
+        {
+            int r = std::min(31, std::max(0, (int)(color[0] * 31.0f / 255.0f + 0.5f)));
+            int g = std::min(63, std::max(0, (int)(color[1] * 63.0f / 255.0f + 0.5f)));
+            int b = std::min(31, std::max(0, (int)(color[2] * 31.0f / 255.0f + 0.5f)));
+            return (uint16_t)((r << 11) | (g << 5) | b);
+        }
+
+        inline void unpackRgb565(uint16_t packed, int color[3])
+        {
+            int r = (packed >> 11) & 31, g = (packed >> 5) & 63, b = packed & 31;
+            color[0] = (r << 3) | (r >> 2);
+            color[1] = (g << 2) | (g >> 4);
+            color[2] = (b << 3) | (b >> 2);
+        }
+
+        // picks the nearest of the four palette colors per texel, returns the index bits and the squared error
+        inline uint32_t bc1Indices(const unsigned char rgba[64], uint16_t color0, uint16_t color1, int& error)
+        {
+            int palette[4][3];
+            unpackRgb565(color0, palette[0]);
+            unpackRgb565(color1, palette[1]);
+            for (int c = 0; c < 3; c++) {
+                palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+                palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+            }
+            uint32_t indices = 0;
+            error = 0;
+            for (int i = 0; i < 16; i++) {
+                int best = 0, bestDistance = 1 << 30;
+                for (int p = 0; p < 4; p++) {
+                    int dr = rgba[i * 4] - palette[p][0], dg = rgba[i * 4 + 1] - palette[p][1], db = rgba[i * 4 + 2] - palette[p][2];
+                    int distance = dr * dr + dg * dg + db * db;
+                    if (distance < bestDistance) {
+                        bestDistance = distance;
+                        best = p;
+                    }
+                }
+                indices |= (uint32_t)best << (2 * i);
+                error += bestDistance;
+            }
+            return indices;
+        }
+
+        // orders the endpoints for the four color mode and quantizes them
+        inline void bc1Endpoints(const float high[3], const float low[3], uint16_t& color0, uint16_t& color1)
+        {
+            color0 = packRgb565(high);
+            color1 = packRgb565(low);
+            if (color0 < color1)
+                std::swap(color0, color1);
+        }
+
+        // least squares endpoints for fixed indices, false if every texel uses the same palette weight
+        inline bool bc1RefineEndpoints(const unsigned char rgba[64], uint32_t indices, float high[3], float low[3])
+        {
+            static const float weights[4] = {1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f};
+            float aa = 0, ab = 0, bb = 0, ax[3] = {0, 0, 0}, bx[3] = {0, 0, 0};
+            for (int i = 0; i < 16; i++) {
+                float a = weights[(indices >> (2 * i)) & 3], b = 1.0f - a;
+                aa += a * a;
+                ab += a * b;
+                bb += b * b;
+                for (int c = 0; c < 3; c++) {
+                    ax[c] += a * rgba[i * 4 + c];
+                    bx[c] += b * rgba[i * 4 + c];
+                }
+            }
+            float determinant = aa * bb - ab * ab;
+            if (determinant < 1e-6f)
+                return false;
+            for (int c = 0; c < 3; c++) {
+                high[c] = std::min(255.0f, std::max(0.0f, (ax[c] * bb - bx[c] * ab) / determinant));
+                low[c] = std::min(255.0f, std::max(0.0f, (bx[c] * aa - ax[c] * ab) / determinant));
+            }
+            return true;
+        }
+    }
+
+    // 4x4 RGBA texels (alpha ignored) to 8 bytes of BC1 in four color mode. The endpoints are the texels furthest
+    // apart along the principal axis of the block, refined once by least squares.
+    inline void EncodeBC1Block(const unsigned char rgba[64], unsigned char out[8])
+    {
+        float mean[3] = {0, 0, 0};
+        for (int i = 0; i < 16; i++)
+            for (int c = 0; c < 3; c++)
+                mean[c] += rgba[i * 4 + c] / 16.0f;
+        float covariance[6] = {0, 0, 0, 0, 0, 0};  // rr rg rb gg gb bb
+        for (int i = 0; i < 16; i++) {
+            float r = rgba[i * 4] - mean[0], g = rgba[i * 4 + 1] - mean[1], b = rgba[i * 4 + 2] - mean[2];
+            covariance[0] += r * r;
+            covariance[1] += r * g;
+            covariance[2] += r * b;
+            covariance[3] += g * g;
+            covariance[4] += g * b;
+            covariance[5] += b * b;
+        }
+        // a few power iterations are plenty for a 3x3 matrix
+        float axis[3] = {1.0f, 1.0f, 1.0f};
+        for (int iteration = 0; iteration < 4; iteration++) {
+            float x = covariance[0] * axis[0] + covariance[1] * axis[1] + covariance[2] * axis[2];
+            float y = covariance[1] * axis[0] + covariance[3] * axis[1] + covariance[4] * axis[2];
+            float z = covariance[2] * axis[0] + covariance[4] * axis[1] + covariance[5] * axis[2];
+            float length = std::max(std::max(std::abs(x), std::abs(y)), std::abs(z));
+            if (length < 1e-6f)
+                break;
+            axis[0] = x / length;
+            axis[1] = y / length;
+            axis[2] = z / length;
+        }
+        int lowest = 0, highest = 0;
+        float lowestProjection = 1e30f, highestProjection = -1e30f;
+        for (int i = 0; i < 16; i++) {
+            float projection = rgba[i * 4] * axis[0] + rgba[i * 4 + 1] * axis[1] + rgba[i * 4 + 2] * axis[2];
+            if (projection < lowestProjection) {
+                lowestProjection = projection;
+                lowest = i;
+            }
+            if (projection > highestProjection) {
+                highestProjection = projection;
+                highest = i;
+            }
+        }
+        float high[3], low[3];
+        for (int c = 0; c < 3; c++) {
+            high[c] = rgba[highest * 4 + c];
+            low[c] = rgba[lowest * 4 + c];
+        }
+
+        uint16_t color0, color1;
+        detail::bc1Endpoints(high, low, color0, color1);
+        int error = 0;
+        uint32_t indices = 0;
+        if (color0 != color1) {
+            indices = detail::bc1Indices(rgba, color0, color1, error);
+            if (detail::bc1RefineEndpoints(rgba, indices, high, low)) {
+                uint16_t refined0, refined1;
+                detail::bc1Endpoints(high, low, refined0, refined1);
+                int refinedError = 0;
+                uint32_t refinedIndices = detail::bc1Indices(rgba, refined0, refined1, refinedError);
+                if (refined0 != refined1 && refinedError < error) {
+                    color0 = refined0;
+                    color1 = refined1;
+                    indices = refinedIndices;
+                }
+            }
+        }
+        // equal endpoints would select the three color mode, every texel is color0 then anyway
+        out[0] = (unsigned char)(color0 & 0xff);
+        out[1] = (unsigned char)(color0 >> 8);
+        out[2] = (unsigned char)(color1 & 0xff);
+        out[3] = (unsigned char)(color1 >> 8);
+        for (int i = 0; i < 4; i++)
+            out[4 + i] = (unsigned char)(indices >> (8 * i));
+    }
+
+    // 16 single channel values to 8 bytes of BC4 (also the alpha block of BC3 and each half of BC5),
+    // always in the eight value mode spanning the block's range
+    inline void EncodeBC4Block(const unsigned char values[16], unsigned char out[8])
+    {
+        int high = 0, low = 255;
+        for (int i = 0; i < 16; i++) {
+            high = std::max(high, (int)values[i]);
+            low = std::min(low, (int)values[i]);
+        }
+        out[0] = (unsigned char)high;
+        out[1] = (unsigned char)low;
+        uint64_t indices = 0;
+        if (high != low) {
+            for (int i = 0; i < 16; i++) {
+                // palette step 0 is high, 7 is low, steps 1..6 are codes 2..7
+                int step = ((high - values[i]) * 14 + (high - low)) / (2 * (high - low));
+                uint64_t code = step == 0 ? 0 : step == 7 ? 1 : (uint64_t)step + 1;
+                indices |= code << (3 * i);
+            }
+        }
+        for (int i = 0; i < 6; i++)
+            out[2 + i] = (unsigned char)(indices >> (8 * i));
+    }
+
+    // Encodes one level, reading past the right and bottom edge repeats the last column and row.
+    inline void EncodeLevel(GLenum format, const unsigned char* pixels, int width, int height, int components,
+                            unsigned char* out)
+    {
+        unsigned int blockBytes = CompressedBlockBytes(format);
+        unsigned char rgba[64], channel[16];
+        for (int blockY = 0; blockY < height; blockY += 4) {
+            for (int blockX = 0; blockX < width; blockX += 4) {
+                for (int i = 0; i < 16; i++) {
+                    int x = std::min(blockX + i % 4, width - 1), y = std::min(blockY + i / 4, height - 1);
+                    const unsigned char* texel = pixels + ((size_t)y * width + x) * components;
+                    for (int c = 0; c < 4; c++)
+                        rgba[i * 4 + c] = c < components ? texel[c] : 255;
+                }
+                if (format == COMPRESSED_RGB_S3TC_DXT1) {
+                    EncodeBC1Block(rgba, out);
+                } else if (format == COMPRESSED_RGBA_S3TC_DXT5) {
+                    for (int i = 0; i < 16; i++)
+                        channel[i] = rgba[i * 4 + 3];
+                    EncodeBC4Block(channel, out);
+                    EncodeBC1Block(rgba, out + 8);
+                } else {
+                    // RGTC: one BC4 block per channel
+                    for (unsigned int half = 0; half < blockBytes / 8; half++) {
+                        for (int i = 0; i < 16; i++)
+                            channel[i] = rgba[i * 4 + half];
+                        EncodeBC4Block(channel, out + 8 * half);
+                    }
+                }
+                out += blockBytes;
+            }
+        }
+    }
+
+    // Compresses an image and its mip levels (GenerateMips) into format (one of CompressedFormatFor's).
+    inline CompressedImage CompressImage(const unsigned char* pixels, int width, int height, int components,
+                                         const std::vector<MipLevel>& mips, GLenum format)
+    {
+        CompressedImage image;
+        image.format = format;
+        image.width = width;
+        image.height = height;
+        image.components = components;
+        size_t total = 0;
+        for (size_t i = 0; i <= mips.size(); i++) {
+            CompressedLevel level;
+            level.width = i == 0 ? width : mips[i - 1].width;
+            level.height = i == 0 ? height : mips[i - 1].height;
+            level.offset = total;
+            level.size = CompressedLevelBytes(format, level.width, level.height);
+            total += level.size;
+            image.levels.push_back(level);
+        }
+        image.data.resize(total);
+        for (size_t i = 0; i < image.levels.size(); i++) {
+            const CompressedLevel& info = image.levels[i];
+            EncodeLevel(format, i == 0 ? pixels : mips[i - 1].pixels.data(), info.width, info.height, components,
+                        image.data.data() + info.offset);
+        }
+        return image;
+    }
+}
+
+#endif //PROJECT_BASE_TEXTURECOMPRESSION_H
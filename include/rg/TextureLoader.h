@@ -0,0 +1,554 @@
+//
+// Decodes images, builds their mip chains (and optionally block compresses them) on the loader threads and uploads
+// them on the thread that owns the GL context.
+//
+
+#ifndef PROJECT_BASE_TEXTURELOADER_H
+#define PROJECT_BASE_TEXTURELOADER_H
+
+#include <glad/glad.h>
+#include <stb_image.h>
+#include <rg/GLState.h>
+#include <rg/MipGenerator.h>
+#include <rg/TextureCache.h>
+#include <rg/TextureReduction.h>
+#include <rg/ThreadPool.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <future>
+#include <iostream>
+#include <map>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+namespace rg {
+
+    struct DecodedImage {
+        std::string path;
+        unsigned char* data = nullptr;
+        int width = 0;
+        int height = 0;
+        int components = 0;
+        double decodeMs = 0.0;  // mip generation and compression included
+        bool srgb = false;      // color data, filtered in linear light and uploaded as sRGB when asked to
+        std::vector<MipLevel> mips;  // levels 1..n of data
+        // set instead of data and mips when the image was cooked (CookImage), format 0 otherwise
+        CompressedImage compressed;
+        bool fromCache = false;
+        // what ReduceImage found when the image was decoded with reduce set; width and height are after it
+        ImageReduction reduction;
+    };
+
+    inline double MillisecondsSince(std::chrono::steady_clock::time_point start)
+    {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    inline MipOptions ImageMipOptions(bool srgb)
+    {
+        MipOptions options;
+        options.srgb = srgb;
+        return options;
+    }
+
+    // Decodes the image and filters its mip chain; reduce shrinks constant and smooth images (ReduceImage). Safe to
+    // call from any thread as long as nobody toggles stbi_set_flip_vertically_on_load meanwhile.
+    inline DecodedImage DecodeImage(const std::string& path, bool srgb = false, bool reduce = false)
+    {
+        auto start = std::chrono::steady_clock::now();
+        DecodedImage image;
+        image.path = path;
+        image.srgb = srgb;
+        image.data = stbi_load(path.c_str(), &image.width, &image.height, &image.components, 0);
+        image.mips = GenerateMips(image.data, image.width, image.height, image.components, ImageMipOptions(srgb));
+        if (reduce)
+            image.reduction = ReduceImage(image.data, image.width, image.height, image.components, image.mips);
+        image.decodeMs = MillisecondsSince(start);
+        return image;
+    }
+
+    // Like DecodeImage, but returns the block compressed mip chain when there is a format for the image: read from
+    // path + ".texcache" when that was cooked from the same file, otherwise encoded here and written there.
+    inline DecodedImage CookImage(const std::string& path, bool srgb = false, bool reduce = false)
+    {
+        auto start = std::chrono::steady_clock::now();
+        DecodedImage image;
+        image.path = path;
+        image.srgb = srgb;
+        std::string cachePath = path + ".texcache";
+        uint64_t sourceHash = 0;
+        bool hashed = HashFile(path, sourceHash);
+        if (hashed && ReadTextureCache(cachePath, sourceHash, srgb, reduce, image.compressed, image.reduction)) {
+            image.width = image.compressed.width;
+            image.height = image.compressed.height;
+            image.components = image.compressed.components;
+            image.fromCache = true;
+        } else {
+            image.data = stbi_load(path.c_str(), &image.width, &image.height, &image.components, 0);
+            image.mips = GenerateMips(image.data, image.width, image.height, image.components, ImageMipOptions(srgb));
+            if (reduce)
+                image.reduction = ReduceImage(image.data, image.width, image.height, image.components, image.mips);
+            GLenum format = image.data ? CompressedFormatFor(image.components) : 0;
+            if (format != 0) {
+                image.compressed = CompressImage(image.data, image.width, image.height, image.components,
+                                                 image.mips, format);
+                stbi_image_free(image.data);
+                image.data = nullptr;
+                image.mips.clear();
+                if (hashed)
+                    WriteTextureCache(cachePath, sourceHash, srgb, reduce, image.compressed, image.reduction);
+            }
+        }
+        image.decodeMs = MillisecondsSince(start);
+        return image;
+    }
+
+    inline bool ImageLoaded(const DecodedImage& image)
+    {
+        return image.data != nullptr || image.compressed.format != 0;
+    }
+
+    // stb keeps two channel images as luminance + alpha, stored as RG
+    inline void SetLuminanceAlphaSwizzle(GLenum target)
+    {
+        glTexParameteri(target, GL_TEXTURE_SWIZZLE_R, GL_RED);
+        glTexParameteri(target, GL_TEXTURE_SWIZZLE_G, GL_RED);
+        glTexParameteri(target, GL_TEXTURE_SWIZZLE_B, GL_RED);
+        glTexParameteri(target, GL_TEXTURE_SWIZZLE_A, GL_GREEN);
+    }
+
+    inline GLenum PixelFormat(int components)
+    {
+        static const GLenum formats[4] = {GL_RED, GL_RG, GL_RGB, GL_RGBA};
+        return formats[std::min(std::max(components, 1), 4) - 1];
+    }
+
+    // srgbDecode has GL convert RGB(A) color images to linear when sampling
+    inline GLenum InternalFormat(const DecodedImage& image, bool srgbDecode)
+    {
+        if (image.compressed.format != 0)
+            return srgbDecode && image.srgb ? SrgbCompressedFormat(image.compressed.format) : image.compressed.format;
+        static const GLenum formats[4] = {GL_R8, GL_RG8, GL_RGB8, GL_RGBA8};
+        if (srgbDecode && image.srgb && image.components == 3)
+            return GL_SRGB8;
+        if (srgbDecode && image.srgb && image.components == 4)
+            return GL_SRGB8_ALPHA8;
+        return formats[std::min(std::max(image.components, 1), 4) - 1];
+    }
+
+    // What sampling a constant image returns, in the layout PixelFormat and the luminance alpha swizzle give the
+    // shader: linear for sRGB images stored in sRGB formats (srgbDecode), color channels missing in the image 0.
+    inline void ConstantSampleColor(const DecodedImage& image, bool srgbDecode, float color[4])
+    {
+        const unsigned char* stored = image.reduction.color;
+        bool linearize = srgbDecode && image.srgb && image.components >= 3;
+        auto channel = [&](int c) {
+            return linearize && c < 3 ? detail::mipTables().srgbToLinear[stored[c]] : stored[c] / 255.0f;
+        };
+        if (image.components == 2) {
+            color[0] = color[1] = color[2] = channel(0);
+            color[3] = channel(1);
+            return;
+        }
+        for (int c = 0; c < 4; c++)
+            color[c] = c < image.components ? channel(c) : (c == 3 ? 1.0f : 0.0f);
+    }
+
+    // texture units 0..n-1 hold the texture arrays of the model being drawn
+    const unsigned int MAX_TEXTURE_ARRAYS = 8;
+
+    // where an image ended up: array -1 if it failed to load, fit into none of the MAX_TEXTURE_ARRAYS arrays or
+    // is a single color, which color then holds (ConstantSampleColor); color is zero for the others
+    struct TextureArrayLayer {
+        int array = -1;
+        int layer = 0;
+        float color[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+    };
+
+    // The images of one model as GL_TEXTURE_2D_ARRAYs, one per distinct size, channel count and internal format,
+    // so drawing the model needs a single set of bindings and each draw picks its layers in the shader.
+    class TextureArraySet {
+    public:
+        // uploads the images (with their mip chains, repeating) and frees their pixel data; srgbDecode stores sRGB
+        // images in sRGB formats. Constant images (ImageReduction) get no layer, only their color. Images of a size
+        // an array of an earlier Build holds become further layers of it (the array is recreated, Id changes). When
+        // the remaining sizes outnumber the free arrays, those with the most images get arrays and every other
+        // image goes into the array matching its largest mip level that one matches, losing the levels above it;
+        // images fitting nowhere are left out and counted in LeftOutCount. Must run on the GL thread, binds
+        // through GL directly.
+        std::vector<TextureArrayLayer> Build(std::vector<DecodedImage>& images, bool srgbDecode = false)
+        {
+            std::vector<TextureArrayLayer> layers(images.size());
+            std::map<GroupKey, std::vector<size_t>> groupsBySize;
+            for (size_t i = 0; i < images.size(); i++) {
+                const DecodedImage& image = images[i];
+                if (ImageLoaded(image) && image.reduction.constant)
+                    ConstantSampleColor(image, srgbDecode, layers[i].color);
+                else if (ImageLoaded(image))
+                    groupsBySize[keyOf(image, srgbDecode)].push_back(i);
+                else
+                    std::cout << "Texture failed to load at path: " << images[i].path << std::endl;
+            }
+
+            // the arrays this call fills: every existing one, then one per new size while there are free slots
+            std::vector<std::vector<size_t>> members(arrays.size());
+            std::vector<std::pair<GroupKey, std::vector<size_t>>> newGroups;
+            for (auto& group : groupsBySize) {
+                int existing = arrayWithKey(group.first);
+                if (existing >= 0)
+                    members[existing] = std::move(group.second);
+                else
+                    newGroups.push_back(std::make_pair(group.first, std::move(group.second)));
+            }
+            std::stable_sort(newGroups.begin(), newGroups.end(), [](const std::pair<GroupKey, std::vector<size_t>>& a,
+                                                                    const std::pair<GroupKey, std::vector<size_t>>& b) {
+                return a.second.size() > b.second.size();
+            });
+            size_t previousArrays = arrays.size();
+            size_t freeArrays = MAX_TEXTURE_ARRAYS - arrays.size();
+            for (size_t g = 0; g < newGroups.size() && g < freeArrays; g++) {
+                const DecodedImage& first = images[newGroups[g].second[0]];
+                arrays.push_back(TextureArray{0, newGroups[g].first, 0, levelCount(first), first.compressed.format != 0});
+                members.push_back(std::move(newGroups[g].second));
+            }
+            for (size_t g = freeArrays; g < newGroups.size(); g++) {
+                unsigned int leftOut = 0;
+                for (size_t i : newGroups[g].second) {
+                    // the array keeping most of the image's resolution
+                    size_t target = arrays.size();
+                    int levels = 0;
+                    for (size_t a = 0; a < arrays.size(); a++) {
+                        int level = matchingLevel(images[i], arrays[a], srgbDecode);
+                        if (level > 0 && (levels == 0 || level < levels)) {
+                            levels = level;
+                            target = a;
+                        }
+                    }
+                    if (levels > 0) {
+                        dropTopLevels(images[i], levels);
+                        members[target].push_back(i);
+                        shrunkCount++;
+                    } else {
+                        leftOut++;
+                    }
+                }
+                if (leftOut > 0)
+                    std::cout << "ERROR::TEXTURE_ARRAYS::TOO_MANY_SIZES " << leftOut << " images of "
+                              << std::get<0>(newGroups[g].first) << "x" << std::get<1>(newGroups[g].first)
+                              << " left out" << std::endl;
+                leftOutCount += leftOut;
+            }
+
+            for (size_t a = 0; a < arrays.size(); a++) {
+                if (members[a].empty())
+                    continue;
+                TextureArray& array = arrays[a];
+                const DecodedImage& first = images[members[a][0]];
+                // the layers of an earlier Build, read back level by level since GL 3.3 cannot copy between textures
+                std::vector<std::vector<unsigned char>> previous;
+                if (array.id != 0)
+                    previous = readBack(array);
+                GLenum internalFormat = std::get<3>(array.key);
+                unsigned int textureID;
+                glGenTextures(1, &textureID);
+                glBindTexture(GL_TEXTURE_2D_ARRAY, textureID);
+                if (first.compressed.format != 0)
+                    uploadCompressed(images, members[a], internalFormat, previous, array.layers);
+                else
+                    uploadUncompressed(images, members[a], internalFormat, previous, array.layers);
+                for (size_t layer = 0; layer < members[a].size(); layer++) {
+                    layers[members[a][layer]].array = (int)a;
+                    layers[members[a][layer]].layer = array.layers + (int)layer;
+                }
+                if (first.components == 2)
+                    SetLuminanceAlphaSwizzle(GL_TEXTURE_2D_ARRAY);
+
+                glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+                glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+                glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+                glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+                glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+                if (array.id != 0)
+                    glDeleteTextures(1, &array.id);
+                array.id = textureID;
+                array.layers += (int)members[a].size();
+                std::cout << "Texture array " << a << ": " << array.layers << " layers of "
+                          << first.width << "x" << first.height << "x" << first.components
+                          << (first.compressed.format != 0 ? " (block compressed)" : "")
+                          << (a < previousArrays ? ", grown" : "") << std::endl;
+            }
+
+            for (DecodedImage& image : images) {
+                stbi_image_free(image.data);
+                image.data = nullptr;
+                image.mips.clear();
+                image.compressed = CompressedImage();
+            }
+            return layers;
+        }
+
+        // array i goes to texture unit i
+        void Bind() const
+        {
+            for (size_t i = 0; i < arrays.size(); i++)
+                GLCache().BindTexture((unsigned int)i, GL_TEXTURE_2D_ARRAY, arrays[i].id);
+        }
+
+        size_t Size() const { return arrays.size(); }
+        unsigned int Id(size_t array) const { return arrays[array].id; }
+        // texture memory of all arrays, mip chains included
+        size_t Bytes() const { return bytes; }
+        // images stored from a smaller mip level to share an array of another size
+        unsigned int ShrunkCount() const { return shrunkCount; }
+        // images in no array because all arrays were taken by other sizes, drawn without their map
+        unsigned int LeftOutCount() const { return leftOutCount; }
+
+    private:
+        // width, height, components and internal format of every layer of an array
+        typedef std::tuple<int, int, int, GLenum> GroupKey;
+
+        struct TextureArray {
+            unsigned int id;
+            GroupKey key;
+            int layers;
+            int levels;
+            bool compressed;
+        };
+
+        std::vector<TextureArray> arrays;
+        size_t bytes = 0;
+        unsigned int shrunkCount = 0;
+        unsigned int leftOutCount = 0;
+
+        static GroupKey keyOf(const DecodedImage& image, bool srgbDecode)
+        {
+            return std::make_tuple(image.width, image.height, image.components, InternalFormat(image, srgbDecode));
+        }
+
+        // levels of the image's mip chain, level 0 included
+        static int levelCount(const DecodedImage& image)
+        {
+            return image.compressed.format != 0 ? (int)image.compressed.levels.size() : (int)image.mips.size() + 1;
+        }
+
+        int arrayWithKey(const GroupKey& key) const
+        {
+            for (size_t a = 0; a < arrays.size(); a++)
+                if (arrays[a].key == key)
+                    return (int)a;
+            return -1;
+        }
+
+        // the mip level of image that can be a layer of array (same size, format and chain length from there
+        // on), 0 if there is none
+        static int matchingLevel(const DecodedImage& image, const TextureArray& array, bool srgbDecode)
+        {
+            if (image.components != std::get<2>(array.key) || InternalFormat(image, srgbDecode) != std::get<3>(array.key))
+                return 0;
+            int levels = levelCount(image);
+            for (int level = 1; level < levels; level++) {
+                int width = image.compressed.format != 0 ? image.compressed.levels[level].width : image.mips[level - 1].width;
+                int height = image.compressed.format != 0 ? image.compressed.levels[level].height : image.mips[level - 1].height;
+                if (width == std::get<0>(array.key) && height == std::get<1>(array.key))
+                    return levels - level == array.levels ? level : 0;
+            }
+            return 0;
+        }
+
+        // makes mip level levels the top of the image, as ReduceImage does
+        static void dropTopLevels(DecodedImage& image, int levels)
+        {
+            if (image.compressed.format != 0) {
+                std::vector<CompressedLevel>& chain = image.compressed.levels;
+                chain.erase(chain.begin(), chain.begin() + levels);
+                image.width = image.compressed.width = chain[0].width;
+                image.height = image.compressed.height = chain[0].height;
+                return;
+            }
+            const MipLevel& top = image.mips[levels - 1];
+            std::memcpy(image.data, top.pixels.data(), top.pixels.size());
+            image.width = top.width;
+            image.height = top.height;
+            image.mips.erase(image.mips.begin(), image.mips.begin() + levels);
+        }
+
+        // every level of an existing array, all its layers back to back
+        static std::vector<std::vector<unsigned char>> readBack(const TextureArray& array)
+        {
+            int components = std::get<2>(array.key);
+            std::vector<std::vector<unsigned char>> levels((size_t)array.levels);
+            glBindTexture(GL_TEXTURE_2D_ARRAY, array.id);
+            glPixelStorei(GL_PACK_ALIGNMENT, 1);
+            for (int level = 0; level < array.levels; level++) {
+                int width = std::max(1, std::get<0>(array.key) >> level);
+                int height = std::max(1, std::get<1>(array.key) >> level);
+                if (array.compressed) {
+                    GLint size = 0;
+                    glGetTexLevelParameteriv(GL_TEXTURE_2D_ARRAY, level, GL_TEXTURE_COMPRESSED_IMAGE_SIZE, &size);
+                    levels[level].resize((size_t)size);
+                    glGetCompressedTexImage(GL_TEXTURE_2D_ARRAY, level, levels[level].data());
+                } else {
+                    levels[level].resize((size_t)width * height * components * array.layers);
+                    glGetTexImage(GL_TEXTURE_2D_ARRAY, level, PixelFormat(components), GL_UNSIGNED_BYTE,
+                                  levels[level].data());
+                }
+            }
+            glPixelStorei(GL_PACK_ALIGNMENT, 4);
+            glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+            return levels;
+        }
+
+        // every level comes from the cooked mip chain, the group's images share format and size; the previous
+        // layers (read back per level) go first
+        void uploadCompressed(const std::vector<DecodedImage>& images, const std::vector<size_t>& members,
+                              GLenum internalFormat, const std::vector<std::vector<unsigned char>>& previous,
+                              int previousLayers)
+        {
+            const CompressedImage& first = images[members[0]].compressed;
+            GLsizei layerCount = (GLsizei)(previousLayers + members.size());
+            for (size_t level = 0; level < first.levels.size(); level++) {
+                const CompressedLevel& info = first.levels[level];
+                glCompressedTexImage3D(GL_TEXTURE_2D_ARRAY, (GLint)level, internalFormat, info.width, info.height,
+                                       layerCount, 0, (GLsizei)(info.size * layerCount), NULL);
+                if (previousLayers > 0)
+                    glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, (GLint)level, 0, 0, 0, info.width, info.height,
+                                              previousLayers, internalFormat, (GLsizei)previous[level].size(),
+                                              previous[level].data());
+                for (size_t layer = 0; layer < members.size(); layer++) {
+                    const CompressedImage& image = images[members[layer]].compressed;
+                    glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, (GLint)level, 0, 0, previousLayers + (GLint)layer,
+                                              info.width, info.height, 1, internalFormat, (GLsizei)info.size,
+                                              image.data.data() + image.levels[level].offset);
+                }
+                bytes += info.size * members.size();
+            }
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, (GLint)first.levels.size() - 1);
+        }
+
+        // level 0 from the decoded pixels, the rest from the mip chains built on the loader threads; the previous
+        // layers (read back per level) go first
+        void uploadUncompressed(const std::vector<DecodedImage>& images, const std::vector<size_t>& members,
+                                GLenum internalFormat, const std::vector<std::vector<unsigned char>>& previous,
+                                int previousLayers)
+        {
+            const DecodedImage& first = images[members[0]];
+            GLenum format = PixelFormat(first.components);
+            GLsizei layerCount = (GLsizei)(previousLayers + members.size());
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+            for (size_t level = 0; level <= first.mips.size(); level++) {
+                int width = level == 0 ? first.width : first.mips[level - 1].width;
+                int height = level == 0 ? first.height : first.mips[level - 1].height;
+                glTexImage3D(GL_TEXTURE_2D_ARRAY, (GLint)level, internalFormat, width, height, layerCount, 0, format,
+                             GL_UNSIGNED_BYTE, NULL);
+                if (previousLayers > 0)
+                    glTexSubImage3D(GL_TEXTURE_2D_ARRAY, (GLint)level, 0, 0, 0, width, height, previousLayers,
+                                    format, GL_UNSIGNED_BYTE, previous[level].data());
+                for (size_t layer = 0; layer < members.size(); layer++) {
+                    const DecodedImage& image = images[members[layer]];
+                    const unsigned char* pixels = level == 0 ? image.data : image.mips[level - 1].pixels.data();
+                    glTexSubImage3D(GL_TEXTURE_2D_ARRAY, (GLint)level, 0, 0, previousLayers + (GLint)layer, width,
+                                    height, 1, format, GL_UNSIGNED_BYTE, pixels);
+                }
+                // drivers pad RGB8 to four bytes per texel
+                bytes += (size_t)width * height * (first.components == 3 ? 4 : first.components) * members.size();
+            }
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, (GLint)first.mips.size());
+        }
+    };
+
+    struct TextureLoadStats {
+        unsigned int textureCount = 0;
+        double decodeMs = 0.0;  // summed over all worker threads
+        double uploadMs = 0.0;  // spent on the GL thread
+        double wallMs = 0.0;    // first request until the last upload finished
+        unsigned int cookedCount = 0;   // block compressed while loading
+        unsigned int cachedCount = 0;   // block compressed data read from a .texcache file
+        unsigned int constantCount = 0; // single color images, drawn from material constants
+        unsigned int reducedCount = 0;  // smooth images stored at a smaller size
+        unsigned int shrunkCount = 0;   // stored from a smaller mip level, out of free texture arrays
+        unsigned int leftOutCount = 0;  // in no texture array at all, out of free texture arrays
+        size_t gpuBytes = 0;            // texture memory, known after UploadAllAsArrays
+    };
+
+    // Collects the images of one model: decoding starts as soon as an image is requested,
+    // the GL uploads happen in UploadAllAsArrays once the caller is done with everything else.
+    class TextureLoader {
+    public:
+        // block compress the images requested from now on (CookImage); DetectS3tc must have run before
+        void SetCompression(bool enabled) { compress = enabled; }
+        // upload sRGB images in sRGB formats, so shaders sample them in linear
+        void SetSrgbDecode(bool enabled) { srgbDecode = enabled; }
+        // shrink constant and smooth images requested from now on (ReduceImage)
+        void SetReduction(bool enabled) { reduce = enabled; }
+
+        // schedules decoding and returns the slot the texture id will be reported in; srgb marks color images
+        unsigned int Request(const std::string& path, bool srgb = false)
+        {
+            if (pending.empty())
+                firstRequest = std::chrono::steady_clock::now();
+            bool reduceImage = reduce;
+            if (compress)
+                pending.push_back(LoaderThreadPool().Submit([path, srgb, reduceImage] {
+                    return CookImage(path, srgb, reduceImage);
+                }));
+            else
+                pending.push_back(LoaderThreadPool().Submit([path, srgb, reduceImage] {
+                    return DecodeImage(path, srgb, reduceImage);
+                }));
+            return (unsigned int)pending.size() - 1;
+        }
+
+        // waits for every image and uploads them into texture arrays, returns the layers indexed by slot
+        std::vector<TextureArrayLayer> UploadAllAsArrays(TextureArraySet& arrays)
+        {
+            std::vector<DecodedImage> images;
+            images.reserve(pending.size());
+            for (std::future<DecodedImage>& image : pending) {
+                images.push_back(image.get());
+                count(images.back());
+            }
+            auto start = std::chrono::steady_clock::now();
+            std::vector<TextureArrayLayer> layers = arrays.Build(images, srgbDecode);
+            stats.uploadMs += MillisecondsSince(start);
+            stats.gpuBytes = arrays.Bytes();
+            stats.shrunkCount = arrays.ShrunkCount();
+            stats.leftOutCount = arrays.LeftOutCount();
+            if (!pending.empty())
+                stats.wallMs = MillisecondsSince(firstRequest);
+            pending.clear();
+            return layers;
+        }
+
+        const TextureLoadStats& Stats() const { return stats; }
+
+    private:
+        std::vector<std::future<DecodedImage>> pending;
+        std::chrono::steady_clock::time_point firstRequest;
+        TextureLoadStats stats;
+        bool compress = false;
+        bool srgbDecode = false;
+        bool reduce = false;
+
+        void count(const DecodedImage& image)
+        {
+            stats.decodeMs += image.decodeMs;
+            stats.textureCount++;
+            if (image.fromCache)
+                stats.cachedCount++;
+            else if (image.compressed.format != 0)
+                stats.cookedCount++;
+            if (image.reduction.constant)
+                stats.constantCount++;
+            else if (image.reduction.droppedLevels > 0)
+                stats.reducedCount++;
+        }
+    };
+}
+
+#endif //PROJECT_BASE_TEXTURELOADER_H
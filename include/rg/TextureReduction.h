@@ -0,0 +1,121 @@
+//
+// Images that do not need their resolution, found from the mip chain on the loader threads: an image of a single
+// color shrinks to one texel and is drawn from a material constant instead, a smooth image drops the top levels
+// that bilinear filtering of a smaller level reproduces anyway.
+//
+
+#ifndef PROJECT_BASE_TEXTUREREDUCTION_H
+#define PROJECT_BASE_TEXTUREREDUCTION_H
+
+#include <rg/MipGenerator.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+namespace rg {
+
+    struct ImageReduction {
+        // every texel within the tolerance of color, the average in the image's own encoding (sRGB for colors)
+        bool constant = false;
+        unsigned char color[4] = {0, 0, 0, 255};
+        // top mip levels removed, the image is now the former level droppedLevels
+        int droppedLevels = 0;
+    };
+
+    namespace detail {
+
+        // Largest difference, in 8-bit steps, between the image and level sampled bilinearly with repeat wrapping
+        // at the image's texel centers, as the GPU would magnify it; stops as soon as it exceeds limit.
+        inline int bilinearError(const unsigned char* pixels, int width, int height, int components,
+                                 const MipLevel& level, int limit)
+        {
+            const float scaleX = (float)level.width / (float)width;
+            const float scaleY = (float)level.height / (float)height;
+            int largest = 0;
+            for (int y = 0; y < height; y++) {
+                float v = (y + 0.5f) * scaleY - 0.5f;
+                int y0 = (int)std::floor(v);
+                float fy = v - (float)y0;
+                const size_t levelRow = (size_t)level.width * components;
+                const unsigned char* row0 = &level.pixels[(size_t)((y0 + level.height) % level.height) * levelRow];
+                const unsigned char* row1 = &level.pixels[(size_t)((y0 + 1) % level.height) * levelRow];
+                const unsigned char* source = pixels + (size_t)y * width * components;
+                for (int x = 0; x < width; x++) {
+                    float u = (x + 0.5f) * scaleX - 0.5f;
+                    int x0 = (int)std::floor(u);
+                    float fx = u - (float)x0;
+                    size_t left = (size_t)((x0 + level.width) % level.width) * components;
+                    size_t right = (size_t)((x0 + 1) % level.width) * components;
+                    for (int c = 0; c < components; c++) {
+                        float top = row0[left + c] + (row0[right + c] - row0[left + c]) * fx;
+                        float bottom = row1[left + c] + (row1[right + c] - row1[left + c]) * fx;
+                        int error = (int)std::lround(std::fabs(top + (bottom - top) * fy - source[x * components + c]));
+                        largest = std::max(largest, error);
+                    }
+                }
+                if (largest > limit)
+                    break;
+            }
+            return largest;
+        }
+    }
+
+    // Analyzes an image and the mip chain GenerateMips built for it, and shrinks both in place: a constant image
+    // down to its 1x1 level, a smooth one down to the smallest level (at least minSize texels, halved exactly)
+    // whose bilinear magnification stays within tolerance 8-bit steps of every texel. pixels keeps its allocation,
+    // width and height become those of the new top level.
+    inline ImageReduction ReduceImage(unsigned char* pixels, int& width, int& height, int components,
+                                      std::vector<MipLevel>& mips, int tolerance = 2, int minSize = 4)
+    {
+        ImageReduction reduction;
+        if (!pixels || components <= 0 || components > 4)
+            return reduction;
+
+        // row by row, most images give up within the first one
+        unsigned char low[4] = {255, 255, 255, 255}, high[4] = {0, 0, 0, 0};
+        const size_t rowBytes = (size_t)width * components;
+        reduction.constant = true;
+        for (int y = 0; y < height && reduction.constant; y++) {
+            const unsigned char* row = pixels + y * rowBytes;
+            for (size_t i = 0; i < rowBytes; i += components)
+                for (int c = 0; c < components; c++) {
+                    low[c] = std::min(low[c], row[i + c]);
+                    high[c] = std::max(high[c], row[i + c]);
+                }
+            for (int c = 0; c < components; c++)
+                reduction.constant = reduction.constant && high[c] - low[c] <= tolerance;
+        }
+
+        int dropped = 0;
+        if (reduction.constant) {
+            dropped = (int)mips.size();
+        } else {
+            for (size_t level = 0; level < mips.size(); level++) {
+                const MipLevel& mip = mips[level];
+                int factor = 1 << (level + 1);
+                if (mip.width < minSize || mip.height < minSize || width % factor != 0 || height % factor != 0
+                    || detail::bilinearError(pixels, width, height, components, mip, tolerance) > tolerance)
+                    break;
+                dropped = (int)level + 1;
+            }
+        }
+        if (dropped > 0) {
+            MipLevel& top = mips[dropped - 1];
+            std::memcpy(pixels, top.pixels.data(), top.pixels.size());
+            width = top.width;
+            height = top.height;
+            mips.erase(mips.begin(), mips.begin() + dropped);
+        }
+        // the 1x1 level is the average the mip filter computed, averaged in linear light for sRGB colors
+        if (reduction.constant)
+            for (int c = 0; c < components; c++)
+                reduction.color[c] = pixels[c];
+        reduction.droppedLevels = dropped;
+        return reduction;
+    }
+}
+
+#endif //PROJECT_BASE_TEXTUREREDUCTION_H
@@ -0,0 +1,93 @@
+//
+// Fixed size worker pool used by the asset loaders.
+//
+
+#ifndef PROJECT_BASE_THREADPOOL_H
+#define PROJECT_BASE_THREADPOOL_H
+
+#include <algorithm>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace rg {
+
+    class ThreadPool {
+    public:
+        explicit ThreadPool(unsigned int threadCount)
+        {
+            threadCount = std::max(1u, threadCount);
+            for (unsigned int i = 0; i < threadCount; ++i)
+                workers.emplace_back([this] { workerLoop(); });
+        }
+        ThreadPool(const ThreadPool&) = delete;
+        ThreadPool& operator=(const ThreadPool&) = delete;
+
+        ~ThreadPool()
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stopping = true;
+            }
+            wakeUp.notify_all();
+            for (std::thread& worker : workers)
+                worker.join();
+        }
+
+        unsigned int Size() const { return (unsigned int)workers.size(); }
+
+        // queues a job and returns a future for its result
+        template<typename F>
+        std::future<typename std::result_of<F()>::type> Submit(F job)
+        {
+            using Result = typename std::result_of<F()>::type;
+            auto task = std::make_shared<std::packaged_task<Result()>>(std::move(job));
+            std::future<Result> result = task->get_future();
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                jobs.emplace([task] { (*task)(); });
+            }
+            wakeUp.notify_one();
+            return result;
+        }
+
+    private:
+        std::vector<std::thread> workers;
+        std::queue<std::function<void()>> jobs;
+        std::mutex mutex;
+        std::condition_variable wakeUp;
+        bool stopping = false;
+
+        void workerLoop()
+        {
+            for (;;) {
+                std::function<void()> job;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    wakeUp.wait(lock, [this] { return stopping || !jobs.empty(); });
+                    if (stopping && jobs.empty())
+                        return;
+                    job = std::move(jobs.front());
+                    jobs.pop();
+                }
+                job();
+            }
+        }
+    };
+
+    // pool shared by everything that loads assets, sized to leave the GL thread a core of its own;
+    // hardware_concurrency() is 0 when it cannot be determined, which gets one worker
+    inline ThreadPool& LoaderThreadPool()
+    {
+        static ThreadPool pool(std::max(2u, std::thread::hardware_concurrency()) - 1);
+        return pool;
+    }
+}
+
+#endif //PROJECT_BASE_THREADPOOL_H
@@ -0,0 +1,89 @@
+//
+// Scalar encodings used by the packed vertex formats: octahedral unit vectors, snorm/unorm16 and half floats.
+//
+
+#ifndef PROJECT_BASE_VERTEXPACKING_H
+#define PROJECT_BASE_VERTEXPACKING_H
+
+#include <glm/glm.hpp>
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+namespace rg {
+
+    // layout of the vertex buffer a Mesh uploads, chosen per model at load
+    enum class VertexFormat {
+        Full,                 // Vertex as is, 56 bytes
+        Packed,               // PackedVertex, 24 bytes, positions quantized to the mesh bounds
+        PackedFloatPosition,  // PackedVertexFloatPosition, 28 bytes, exact positions
+    };
+
+    inline const char* VertexFormatName(VertexFormat format)
+    {
+        switch (format) {
+            case VertexFormat::Packed: return "packed";
+            case VertexFormat::PackedFloatPosition: return "packed-float";
+            default: return "full";
+        }
+    }
+
+    inline int16_t ToSnorm16(float value)
+    {
+        return (int16_t)std::lround(glm::clamp(value, -1.0f, 1.0f) * 32767.0f);
+    }
+
+    inline uint16_t ToUnorm16(float value)
+    {
+        return (uint16_t)std::lround(glm::clamp(value, 0.0f, 1.0f) * 65535.0f);
+    }
+
+    // unit vector to the [-1, 1]^2 square of an octahedron unfolded over the xy plane
+    inline glm::vec2 OctEncode(glm::vec3 n)
+    {
+        float l1 = std::fabs(n.x) + std::fabs(n.y) + std::fabs(n.z);
+        if (l1 == 0.0f)
+            return glm::vec2(0.0f);
+        n = n / l1;
+        glm::vec2 e(n.x, n.y);
+        if (n.z < 0.0f) {
+            // fold the lower half over the diagonals
+            e = glm::vec2((1.0f - std::fabs(n.y)) * (n.x >= 0.0f ? 1.0f : -1.0f),
+                          (1.0f - std::fabs(n.x)) * (n.y >= 0.0f ? 1.0f : -1.0f));
+        }
+        return e;
+    }
+
+    // IEEE 754 binary16, round to nearest; GL_HALF_FLOAT data
+    inline uint16_t FloatToHalf(float value)
+    {
+        uint32_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        uint32_t sign = (bits >> 16) & 0x8000u;
+        uint32_t floatExponent = (bits >> 23) & 0xffu;
+        uint32_t mantissa = bits & 0x7fffffu;
+        if (floatExponent == 0xffu) // infinity or NaN
+            return (uint16_t)(sign | 0x7c00u | (mantissa ? 0x200u : 0u));
+        int exponent = (int)floatExponent - 127 + 15;
+        if (exponent >= 31) // too large, becomes infinity
+            return (uint16_t)(sign | 0x7c00u);
+        if (exponent <= 0) {
+            // subnormal half (or zero)
+            if (exponent < -10)
+                return (uint16_t)sign;
+            mantissa |= 0x800000u;
+            uint32_t shift = (uint32_t)(14 - exponent);
+            uint32_t half = mantissa >> shift;
+            if ((mantissa >> (shift - 1)) & 1u)
+                half++;
+            return (uint16_t)(sign | half);
+        }
+        uint32_t half = sign | ((uint32_t)exponent << 10) | (mantissa >> 13);
+        if (mantissa & 0x1000u) // a carry into the exponent is still the correctly rounded value
+            half++;
+        return (uint16_t)half;
+    }
+}
+
+#endif //PROJECT_BASE_VERTEXPACKING_H
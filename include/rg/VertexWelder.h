@@ -0,0 +1,141 @@
+//
+// Vertex welding done once at import: vertices whose position, normal and texture coordinates quantize to the
+// same values are merged through an open addressing hash table, turning the unindexed triangle soup Assimp
+// produces for OBJ files into a truly indexed mesh.
+//
+
+#ifndef PROJECT_BASE_VERTEXWELDER_H
+#define PROJECT_BASE_VERTEXWELDER_H
+
+#include <learnopengl/mesh.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+namespace rg {
+
+    struct VertexWeldStats {
+        size_t before = 0;
+        size_t after = 0;
+    };
+
+    namespace detail {
+
+        // quantized position, normal and texture coordinates plus the vertex class, the identity of a vertex
+        // for welding
+        struct WeldKey {
+            int32_t values[9];
+
+            bool operator==(const WeldKey& other) const
+            {
+                return std::memcmp(values, other.values, sizeof(values)) == 0;
+            }
+        };
+
+        inline uint32_t hashWeldKey(const WeldKey& key)
+        {
+            uint32_t hash = 2166136261u;
+            for (int32_t value : key.values) {
+                hash ^= (uint32_t)value;
+                hash *= 16777619u;
+                hash ^= hash >> 15;
+            }
+            return hash;
+        }
+
+        inline int32_t quantize(float value, float scale)
+        {
+            return (int32_t)std::lround((double)value * scale);
+        }
+    }
+
+    // Merges vertices equal up to the quantization and rewrites indices to match, keeping the first occurrence
+    // order. Positions snap to 2^-20 of the mesh's largest extent, normals and texture coordinates to 2^-16.
+    // Tangent frames are not part of the key, Assimp computes them per triangle corner; the merged vertex
+    // gets the normalized sum of its copies instead. Vertices of different classes (if given, one per vertex)
+    // are never merged; vertexRemap receives the welded index of every input vertex.
+    inline VertexWeldStats WeldVertices(std::vector<Vertex>& vertices, std::vector<unsigned int>& indices,
+                                        const std::vector<uint32_t>* classes = nullptr,
+                                        std::vector<unsigned int>* vertexRemap = nullptr)
+    {
+        VertexWeldStats stats;
+        stats.before = stats.after = vertices.size();
+        if (vertexRemap)
+            vertexRemap->clear();
+        if (vertices.empty())
+            return stats;
+
+        glm::vec3 boundsMin = vertices[0].Position, boundsMax = vertices[0].Position;
+        for (const Vertex& vertex : vertices) {
+            boundsMin = glm::min(boundsMin, vertex.Position);
+            boundsMax = glm::max(boundsMax, vertex.Position);
+        }
+        glm::vec3 extent = boundsMax - boundsMin;
+        float largest = std::max(extent.x, std::max(extent.y, extent.z));
+        const float positionScale = largest > 0.0f ? 1048576.0f / largest : 1.0f;
+        const float attributeScale = 65536.0f;
+
+        // power of two with at most 50% load, linear probing; slots hold indices into welded, ~0u is empty
+        size_t capacity = 1;
+        while (capacity < vertices.size() * 2)
+            capacity <<= 1;
+        const size_t mask = capacity - 1;
+        std::vector<unsigned int> table(capacity, ~0u);
+
+        std::vector<Vertex> welded;
+        std::vector<detail::WeldKey> keys;
+        std::vector<unsigned int> remap(vertices.size());
+        welded.reserve(vertices.size());
+        keys.reserve(vertices.size());
+        for (size_t i = 0; i < vertices.size(); ++i) {
+            const Vertex& vertex = vertices[i];
+            detail::WeldKey key;
+            key.values[0] = detail::quantize(vertex.Position.x - boundsMin.x, positionScale);
+            key.values[1] = detail::quantize(vertex.Position.y - boundsMin.y, positionScale);
+            key.values[2] = detail::quantize(vertex.Position.z - boundsMin.z, positionScale);
+            key.values[3] = detail::quantize(vertex.Normal.x, attributeScale);
+            key.values[4] = detail::quantize(vertex.Normal.y, attributeScale);
+            key.values[5] = detail::quantize(vertex.Normal.z, attributeScale);
+            key.values[6] = detail::quantize(vertex.TexCoords.x, attributeScale);
+            key.values[7] = detail::quantize(vertex.TexCoords.y, attributeScale);
+            key.values[8] = classes ? (int32_t)(*classes)[i] : 0;
+
+            size_t slot = detail::hashWeldKey(key) & mask;
+            while (table[slot] != ~0u && !(keys[table[slot]] == key))
+                slot = (slot + 1) & mask;
+            if (table[slot] == ~0u) {
+                table[slot] = (unsigned int)welded.size();
+                welded.push_back(vertex);
+                keys.push_back(key);
+            } else {
+                Vertex& target = welded[table[slot]];
+                target.Tangent += vertex.Tangent;
+                target.Bitangent += vertex.Bitangent;
+            }
+            remap[i] = table[slot];
+        }
+
+        if (welded.size() < vertices.size()) {
+            for (Vertex& vertex : welded) {
+                float tangentLength = glm::length(vertex.Tangent);
+                float bitangentLength = glm::length(vertex.Bitangent);
+                if (tangentLength > 0.0f)
+                    vertex.Tangent /= tangentLength;
+                if (bitangentLength > 0.0f)
+                    vertex.Bitangent /= bitangentLength;
+            }
+        }
+        for (unsigned int& index : indices)
+            index = remap[index];
+        if (vertexRemap)
+            vertexRemap->swap(remap);
+        vertices.swap(welded);
+        stats.after = vertices.size();
+        return stats;
+    }
+}
+
+#endif //PROJECT_BASE_VERTEXWELDER_H
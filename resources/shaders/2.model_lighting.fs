@@ -3,6 +3,7 @@ out vec4 FragColor;
 
 struct PointLight {
     vec3 position;
+    float radius;
 
     vec3 specular;
     vec3 diffuse;
@@ -14,23 +15,79 @@ struct PointLight {
 };
 
 struct Material {
-    sampler2D texture_diffuse1;
-    sampler2D texture_specular1;
-
     float shininess;
 };
 in vec2 TexCoords;
 in vec3 Normal;
 in vec3 FragPos;
+flat in int MaterialIndex;
+
+layout (std140) uniform Camera {
+    mat4 projection;
+    mat4 view;
+    vec4 viewPosition;
+};
+
+layout (std140) uniform Lights {
+    uvec4 clusterDims;    // clusters in x, y, z, light count
+    vec4 clusterParams;   // tiles per pixel (xy), depth slice scale and bias (zw)
+};
+
+// rg::LightClusters buffers: four texels per light, (offset, count) per cluster, flat light index list
+uniform samplerBuffer lightData;
+uniform usamplerBuffer lightGrid;
+uniform usamplerBuffer lightIndices;
 
-uniform PointLight pointLight1;
-uniform PointLight pointLight2;
-uniform PointLight pointLight3;
 uniform Material material;
+// two texels per material (see rg::GpuMaterial): texture array and layer of the diffuse (xy) and specular map (zw),
+// then the diffuse (rgb) and specular (a) color used instead of a map whose array is -1
+uniform samplerBuffer materialData;
+// the model's rg::TextureArraySet, one array per image size and channel count
+uniform sampler2DArray textureArrays[8];
+
+// GLSL 3.30 only indexes sampler arrays with constants; array is the same for a whole draw
+vec4 SampleTextureArray(int array, float layer, vec2 uv)
+{
+    vec3 coords = vec3(uv, layer);
+    switch (array) {
+        case 0: return texture(textureArrays[0], coords);
+        case 1: return texture(textureArrays[1], coords);
+        case 2: return texture(textureArrays[2], coords);
+        case 3: return texture(textureArrays[3], coords);
+        case 4: return texture(textureArrays[4], coords);
+        case 5: return texture(textureArrays[5], coords);
+        case 6: return texture(textureArrays[6], coords);
+        case 7: return texture(textureArrays[7], coords);
+    }
+    return vec4(0.0); // no such map
+}
+
+// a single color map (or a missing one, black) comes from the material instead of a texture fetch
+vec4 SampleMaterialMap(int array, float layer, vec4 color, vec2 uv)
+{
+    return array < 0 ? color : SampleTextureArray(array, layer, uv);
+}
+
+PointLight FetchPointLight(int index)
+{
+    vec4 t0 = texelFetch(lightData, 4 * index);
+    vec4 t1 = texelFetch(lightData, 4 * index + 1);
+    vec4 t2 = texelFetch(lightData, 4 * index + 2);
+    vec4 t3 = texelFetch(lightData, 4 * index + 3);
+    PointLight light;
+    light.position = t0.xyz;
+    light.radius = t0.w;
+    light.ambient = t1.xyz;
+    light.constant = t1.w;
+    light.diffuse = t2.xyz;
+    light.linear = t2.w;
+    light.specular = t3.xyz;
+    light.quadratic = t3.w;
+    return light;
+}
 
-uniform vec3 viewPosition;
 // calculates the color when using a point light.
-vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir)
+vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir, vec3 diffuseColor, float specularColor)
 {
     vec3 lightDir = normalize(light.position - fragPos);
     // diffuse shading
@@ -42,10 +99,13 @@ vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir)
     // attenuation
     float distance = length(light.position - fragPos);
     float attenuation = 1.0 / (light.constant + light.linear * distance + light.quadratic * (distance * distance));
+    // fade out towards the culling radius so cluster borders never show
+    float falloff = clamp(1.0 - pow(distance / light.radius, 4.0), 0.0, 1.0);
+    attenuation *= falloff * falloff;
     // combine results
-    vec3 ambient = light.ambient * vec3(texture(material.texture_diffuse1, TexCoords));
-    vec3 diffuse = light.diffuse * diff * vec3(texture(material.texture_diffuse1, TexCoords));
-    vec3 specular = light.specular * spec * vec3(texture(material.texture_specular1, TexCoords).xxx);
+    vec3 ambient = light.ambient * diffuseColor;
+    vec3 diffuse = light.diffuse * diff * diffuseColor;
+    vec3 specular = light.specular * spec * specularColor;
     ambient *= attenuation;
     diffuse *= attenuation;
     specular *= attenuation;
@@ -55,7 +115,24 @@ vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir)
 void main()
 {
     vec3 normal = normalize(Normal);
-    vec3 viewDir = normalize(viewPosition - FragPos);
-    vec3 result = CalcPointLight(pointLight3, normal, FragPos, viewDir) + CalcPointLight(pointLight2, normal, FragPos, viewDir) + CalcPointLight(pointLight1, normal, FragPos, viewDir);
+    vec3 viewDir = normalize(viewPosition.xyz - FragPos);
+    // find the cluster of this fragment and only shade with the lights assigned to it
+    float depth = -(view * vec4(FragPos, 1.0)).z;
+    ivec3 cluster = ivec3(ivec2(gl_FragCoord.xy * clusterParams.xy), int(log(max(depth, 1e-4)) * clusterParams.z + clusterParams.w));
+    cluster = clamp(cluster, ivec3(0), ivec3(clusterDims.xyz) - 1);
+    int clusterIndex = cluster.x + int(clusterDims.x) * (cluster.y + int(clusterDims.y) * cluster.z);
+    uvec2 lightRange = texelFetch(lightGrid, clusterIndex).xy;
+
+    // sampled once instead of per light
+    vec4 materialLayers = texelFetch(materialData, 2 * MaterialIndex);
+    vec4 materialColors = texelFetch(materialData, 2 * MaterialIndex + 1);
+    vec3 diffuseColor = SampleMaterialMap(int(materialLayers.x), materialLayers.y, vec4(materialColors.rgb, 1.0), TexCoords).rgb;
+    float specularColor = SampleMaterialMap(int(materialLayers.z), materialLayers.w, vec4(materialColors.a), TexCoords).x;
+    vec3 result = vec3(0.0);
+    for (uint i = 0u; i < lightRange.y; i++)
+    {
+        int lightIndex = int(texelFetch(lightIndices, int(lightRange.x + i)).x);
+        result += CalcPointLight(FetchPointLight(lightIndex), normal, FragPos, viewDir, diffuseColor, specularColor);
+    }
     FragColor = vec4(result, 1.0);
 }
\ No newline at end of file
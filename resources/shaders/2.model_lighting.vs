@@ -1,20 +1,48 @@
 #version 330 core
+// packed meshes (see Mesh) store quantized positions and octahedral normals in the same locations
 layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec3 aNormal;
 layout (location = 2) in vec2 aTexCoords;
+// index of the instance's entry in drawData, instanced through baseInstance (see rg::IndirectDrawList)
+layout (location = 5) in uint aDrawId;
 
 out vec2 TexCoords;
 out vec3 Normal;
 out vec3 FragPos;
+flat out int MaterialIndex;
+
+layout (std140) uniform Camera {
+    mat4 projection;
+    mat4 view;
+    vec4 viewPosition;
+};
 
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+// six texels per draw: position offset and material index, position scale and the packed normals flag,
+// the rows of the instance's transform into model space, and the start of its own texture coordinates
+uniform samplerBuffer drawData;
+// texture coordinates of instances with their own UV layout, fetched by texCoordBase + gl_VertexID
+uniform samplerBuffer instanceTexCoords;
+
+vec3 OctDecode(vec2 e)
+{
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    if (n.z < 0.0)
+        n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+    return normalize(n);
+}
 
 void main()
 {
-    FragPos = vec3(model * vec4(aPos, 1.0));
-    Normal = aNormal;
-    TexCoords = aTexCoords;    
+    int base = 6 * int(aDrawId);
+    vec4 offsetMaterial = texelFetch(drawData, base);
+    vec4 scalePacked = texelFetch(drawData, base + 1);
+    mat4 instance = transpose(mat4(texelFetch(drawData, base + 2), texelFetch(drawData, base + 3),
+                                   texelFetch(drawData, base + 4), vec4(0.0, 0.0, 0.0, 1.0)));
+    FragPos = vec3(model * instance * vec4(offsetMaterial.xyz + aPos * scalePacked.xyz, 1.0));
+    Normal = mat3(instance) * (scalePacked.w != 0.0 ? OctDecode(aNormal.xy) : aNormal);
+    MaterialIndex = int(offsetMaterial.w);
+    vec4 texCoordSet = texelFetch(drawData, base + 5);
+    TexCoords = texCoordSet.y != 0.0 ? texelFetch(instanceTexCoords, int(texCoordSet.x) + gl_VertexID).xy : aTexCoords;
     gl_Position = projection * view * vec4(FragPos, 1.0);
 }
\ No newline at end of file
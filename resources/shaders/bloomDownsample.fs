@@ -0,0 +1,18 @@
+#version 330 core
+out vec4 FragColor;
+
+in vec2 TexCoords;
+
+uniform sampler2D image;
+// half the size of a texel of image
+uniform vec2 halfPixel;
+
+void main(){
+    vec3 result = texture(image, TexCoords).xyz * 4.0f;
+    result += texture(image, TexCoords - halfPixel).xyz;
+    result += texture(image, TexCoords + halfPixel).xyz;
+    result += texture(image, TexCoords + vec2(halfPixel.x, -halfPixel.y)).xyz;
+    result += texture(image, TexCoords - vec2(halfPixel.x, -halfPixel.y)).xyz;
+
+    FragColor = vec4(result / 8.0f, 1.0f);
+}
\ No newline at end of file
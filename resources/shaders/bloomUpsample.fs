@@ -0,0 +1,21 @@
+#version 330 core
+out vec4 FragColor;
+
+in vec2 TexCoords;
+
+uniform sampler2D image;
+// half the size of a texel of image
+uniform vec2 halfPixel;
+
+void main(){
+    vec3 result = texture(image, TexCoords + vec2(-halfPixel.x * 2.0f, 0.0f)).xyz;
+    result += texture(image, TexCoords + vec2(-halfPixel.x, halfPixel.y)).xyz * 2.0f;
+    result += texture(image, TexCoords + vec2(0.0f, halfPixel.y * 2.0f)).xyz;
+    result += texture(image, TexCoords + vec2(halfPixel.x, halfPixel.y)).xyz * 2.0f;
+    result += texture(image, TexCoords + vec2(halfPixel.x * 2.0f, 0.0f)).xyz;
+    result += texture(image, TexCoords + vec2(halfPixel.x, -halfPixel.y)).xyz * 2.0f;
+    result += texture(image, TexCoords + vec2(0.0f, -halfPixel.y * 2.0f)).xyz;
+    result += texture(image, TexCoords + vec2(-halfPixel.x, -halfPixel.y)).xyz * 2.0f;
+
+    FragColor = vec4(result / 12.0f, 1.0f);
+}
\ No newline at end of file
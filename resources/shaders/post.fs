@@ -0,0 +1,39 @@
+#version 330 core
+// Fused post-processing pass. rg::PostStack compiles one variant per set of enabled effects
+// by defining BLOOM, TONEMAP, GAMMA and GRAYSCALE, the effects run in that order.
+
+out vec4 FragColor;
+
+in vec2 TexCoords;
+
+uniform sampler2D scene;
+#ifdef BLOOM
+uniform sampler2D bloomBlur;
+#endif
+#ifdef TONEMAP
+uniform float exposure;
+#endif
+
+void main(){
+    vec3 color = texture(scene, TexCoords).rgb;
+
+#ifdef BLOOM
+    color += texture(bloomBlur, TexCoords).rgb;
+#endif
+
+#ifdef TONEMAP
+    color = vec3(1.0f) - exp(-color * exposure);
+#endif
+
+#ifdef GAMMA
+    const float gamma = 2.2f;
+    color = pow(color, vec3(1.0f / gamma));
+#endif
+
+#ifdef GRAYSCALE
+    float average = 0.2f * color.r + 0.7f * color.g + 0.07f * color.b;
+    color = vec3(average);
+#endif
+
+    FragColor = vec4(color, 1.0f);
+}
@@ -13,8 +13,21 @@
 #include <learnopengl/shader.h>
 #include <learnopengl/camera.h>
 #include <learnopengl/model.h>
-
+#include <rg/FrameUniforms.h>
+#include <rg/LightClusters.h>
+#include <rg/Bloom.h>
+#include <rg/PostStack.h>
+#include <rg/Profiler.h>
+#include <rg/Benchmark.h>
+#include <rg/RenderQueue.h>
+#include <rg/GLState.h>
+
+#include <cfloat>
+#include <chrono>
+#include <iomanip>
 #include <iostream>
+#include <random>
+#include <sstream>
 
 void framebuffer_size_callback(GLFWwindow *window, int width, int height);
 
@@ -28,9 +41,16 @@ void key_callback(GLFWwindow *window, int key, int scancode, int action, int mod
 
 unsigned int loadTexture(char const* path);
 
+void runMipBenchmark();
+
 // settings
 const unsigned int SCR_WIDTH = 800;
 const unsigned int SCR_HEIGHT = 600;
+const float FAR_PLANE = 100.0f;
+
+// render queue passes, executed in this order
+const unsigned int PASS_OPAQUE = 0;
+const unsigned int PASS_TRANSPARENT = 1;
 
 // camera
 
@@ -53,12 +73,50 @@ struct PointLight {
     float quadratic;
 };
 
+rg::GpuPointLight toGpuLight(const PointLight& light) {
+    rg::GpuPointLight result;
+    result.position = light.position;
+    result.ambient = light.ambient;
+    result.diffuse = light.diffuse;
+    result.specular = light.specular;
+    result.constant = light.constant;
+    result.linear = light.linear;
+    result.quadratic = light.quadratic;
+    float intensity = std::max(std::max(light.diffuse.r, light.diffuse.g), light.diffuse.b);
+    intensity = std::max(intensity, std::max(std::max(light.ambient.r, light.ambient.g), light.ambient.b));
+    result.radius = rg::LightRadius(intensity, light.constant, light.linear, light.quadratic, 1000.0f);
+    return result;
+}
+
+// fills the room with small colored lights at deterministic random positions, for stress testing the light clusters
+void spawnBenchmarkLights(std::vector<PointLight>& lights, int count, glm::vec3 boundsMin, glm::vec3 boundsMax) {
+    std::mt19937 rng(1337);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    lights.clear();
+    for (int i = 0; i < count; i++) {
+        PointLight light;
+        light.position = boundsMin + glm::vec3(unit(rng), unit(rng) * 0.5f, unit(rng)) * (boundsMax - boundsMin);
+        glm::vec3 color(unit(rng), unit(rng), unit(rng));
+        light.ambient = color * 0.02f;
+        light.diffuse = color * 3.0f;
+        light.specular = color;
+        light.constant = 1.0f;
+        light.linear = 0.7f;
+        light.quadratic = 1.0f;
+        lights.push_back(light);
+    }
+}
+
 struct ProgramState {
     glm::vec3 clearColor = glm::vec3(0);
     bool ImGuiEnabled = false;
     bool grayscaleEnabled = false;
     bool hdr = true;
     bool bloom = true;
+    bool gamma = true;
+    bool dualFilterBloom = true;
+    // GPU time of the bloom pass, per path (gaussian, dual filter)
+    double bloomMs[2] = {0.0, 0.0};
     float exposure = 0.1f;
     Camera camera;
     bool CameraMouseMovementUpdateEnabled = true;
@@ -67,9 +125,26 @@ struct ProgramState {
     glm::vec3 horsePosition = glm::vec3(-37.0f, 0.0f, -35.0f);
     float horseScale = 0.05f;
     glm::vec3 lightbeamPos = glm::vec3(0.0f, 0.0f, 0.0f);
-    PointLight pointLight1;
-    PointLight pointLight2;
-    PointLight pointLight3;
+    std::vector<PointLight> pointLights;
+    int benchmarkLightCount = 0;
+    rg::LightClusterStats lightStats;
+    bool frustumCulling = true;
+    // GPU memory of the model vertex/index buffers and the vertex layout
+    size_t vertexBufferBytes = 0;
+    size_t indexBufferBytes = 0;
+    rg::VertexFormat vertexFormat = rg::VertexFormat::Full;
+    // draw commands of the models with nothing culled, without and with static batching
+    bool staticBatching = false;
+    unsigned int unbatchedDraws = 0;
+    unsigned int batchedDraws = 0;
+    rg::CullStats cullStats;
+    // glMultiDrawElementsIndirect per material instead of a draw call per mesh (when the context has it)
+    bool multiDrawIndirect = true;
+    rg::IndirectDrawStats drawStats;
+    // state changes of the last frame's render queue
+    rg::RenderQueueStats queueStats;
+    // GL binds/enables of the last frame that went to the driver and that the state cache dropped
+    rg::GLStateStats glStats;
     ProgramState()
             : camera(glm::vec3(0.0f, 0.0f, 3.0f)) {}
 
@@ -111,16 +186,59 @@ void ProgramState::LoadFromFile(std::string filename) {
 }
 
 ProgramState *programState;
+rg::Profiler profiler;
 
 void DrawImGui(ProgramState *programState);
 
-int main() {
+void DrawProfilerWindow(rg::Profiler &profiler);
+
+// draws the meshes of the model that are inside the view, or all of them while culling is off; the render
+// queue has bound the model's VAO and textures
+void drawModel(Model &model, const glm::mat4 &modelViewProjection, rg::CullStats &stats, rg::IndirectDrawStats &drawStats) {
+    rg::IndirectDrawStats modelStats;
+    if (programState->frustumCulling) {
+        modelStats = model.Draw(rg::Frustum::FromMatrix(modelViewProjection), stats, programState->multiDrawIndirect);
+    } else {
+        modelStats = model.Draw(programState->multiDrawIndirect);
+        stats.drawn += model.ObjectCount();
+    }
+    drawStats.drawCalls += modelStats.drawCalls;
+    drawStats.commands += modelStats.commands;
+}
+
+// the render queue material of a model drawn with shader; maps the shader samples that the model skipped when it
+// was loaded for another shader are loaded first
+unsigned int registerModelMaterial(rg::RenderQueue &renderQueue, Model &model, const Shader &shader) {
+    model.LoadTextures(rg::TextureUsage::FromProgram(shader.ID));
+    return renderQueue.RegisterMaterial([&model] { model.BindTextures(); });
+}
+
+int main(int argc, char **argv) {
+    rg::BenchmarkOptions benchmark;
+    if (!rg::ParseBenchmarkOptions(argc, argv, benchmark))
+        return -1;
+    if (benchmark.mipBenchmark) {
+        runMipBenchmark();
+        return 0;
+    }
+
     // glfw: initialize and configure
     // ------------------------------
+#ifdef GLFW_PLATFORM_NULL
+    // GLFW 3.4+: no display server needed at all, the context is created surfaceless
+    if (benchmark.enabled && benchmark.egl)
+        glfwInitHint(GLFW_PLATFORM, GLFW_PLATFORM_NULL);
+#endif
     glfwInit();
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    if (benchmark.enabled) {
+        // everything is rendered into an offscreen framebuffer, the window only provides the context
+        glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+        if (benchmark.egl)
+            glfwWindowHint(GLFW_CONTEXT_CREATION_API, GLFW_EGL_CONTEXT_API);
+    }
 
 #ifdef __APPLE__
     glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
@@ -148,9 +266,19 @@ int main() {
         std::cout << "Failed to initialize GLAD" << std::endl;
         return -1;
     }
+    bool multiDrawIndirect = rg::LoadMultiDrawIndirect((GLADloadproc) glfwGetProcAddress);
+    std::cout << "Multi draw indirect: " << (multiDrawIndirect ? "supported" : "not supported, one draw per mesh")
+              << std::endl;
+    bool s3tc = rg::DetectS3tc();
+    std::cout << "S3TC: " << (s3tc ? "supported" : "not supported, RGB(A) textures stay uncompressed") << std::endl;
 
     programState = new ProgramState;
-    programState->LoadFromFile("resources/program_state.txt");
+    // benchmark runs start from the default state, so results do not depend on the last interactive session
+    if (!benchmark.enabled)
+        programState->LoadFromFile("resources/program_state.txt");
+    if (benchmark.lights >= 0)
+        programState->benchmarkLightCount = benchmark.lights;
+    programState->multiDrawIndirect = benchmark.multiDrawIndirect;
     if (programState->ImGuiEnabled) {
         glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_NORMAL);
     }
@@ -177,20 +305,53 @@ int main() {
     // build and compile shaders
     // -------------------------
     Shader ourShader("resources/shaders/2.model_lighting.vs", "resources/shaders/2.model_lighting.fs");
-    Shader screenShader("resources/shaders/screenShader.vs", "resources/shaders/screenShader.fs");
     Shader blendingShader("resources/shaders/blendingShader.vs", "resources/shaders/blendingShader.fs");
-    Shader hdrShader("resources/shaders/hdr.vs", "resources/shaders/hdr.fs");
     Shader blurShader("resources/shaders/blur.vs", "resources/shaders/blur.fs");
 
+    // camera and light data shared by all programs through uniform blocks
+    rg::FrameUniforms frameUniforms;
+    frameUniforms.Init();
+    frameUniforms.Attach(ourShader);
+    frameUniforms.Attach(blendingShader);
+
+    rg::LightClusters lightClusters;
+    lightClusters.Init();
+    std::vector<rg::GpuPointLight> gpuLights;
+
+    ourShader.use();
+    ourShader.setFloat("material.shininess", 32.0f);
+    ourShader.setInt("lightData", rg::LIGHT_DATA_TEXTURE_UNIT);
+    ourShader.setInt("lightGrid", rg::LIGHT_GRID_TEXTURE_UNIT);
+    ourShader.setInt("lightIndices", rg::LIGHT_INDEX_TEXTURE_UNIT);
+    ourShader.setInt("drawData", rg::DRAW_DATA_TEXTURE_UNIT);
+    ourShader.setInt("materialData", rg::MATERIAL_DATA_TEXTURE_UNIT);
+    ourShader.setInt("instanceTexCoords", rg::INSTANCE_TEXCOORD_TEXTURE_UNIT);
+    for (unsigned int i = 0; i < rg::MAX_TEXTURE_ARRAYS; i++)
+        ourShader.setInt("textureArrays[" + std::to_string(i) + "]", i);
+
     // load models
     // -----------
-    Model roomModel("resources/objects/blacklodge/untitled.obj");
-    roomModel.SetShaderTextureNamePrefix("material.");
-
-    Model horseModel("resources/objects/horsie/horse.obj");
-    horseModel.SetShaderTextureNamePrefix("material.");
-
-    PointLight& pointLight1 = programState->pointLight1;
+    auto loadStart = std::chrono::steady_clock::now();
+    // only the maps the model shader samples are loaded
+    rg::TextureUsage modelTextureUsage = rg::TextureUsage::FromProgram(ourShader.ID);
+    Model roomModel("resources/objects/blacklodge/untitled.obj", false, benchmark.vertexFormat,
+                    benchmark.compressTextures, benchmark.staticBatching, modelTextureUsage);
+
+    Model horseModel("resources/objects/horsie/horse.obj", false, benchmark.vertexFormat,
+                     benchmark.compressTextures, benchmark.staticBatching, modelTextureUsage);
+
+    std::cout << "Startup: models loaded in " << rg::MillisecondsSince(loadStart) << " ms (texture decode "
+              << roomModel.textureStats.decodeMs + horseModel.textureStats.decodeMs << " ms on loader threads, upload "
+              << roomModel.textureStats.uploadMs + horseModel.textureStats.uploadMs << " ms)" << std::endl;
+    programState->vertexBufferBytes = roomModel.VertexBufferSize() + horseModel.VertexBufferSize();
+    programState->indexBufferBytes = roomModel.IndexBufferSize() + horseModel.IndexBufferSize();
+    programState->vertexFormat = benchmark.vertexFormat;
+    programState->staticBatching = benchmark.staticBatching;
+    programState->unbatchedDraws = roomModel.batchStats.drawsBefore + horseModel.batchStats.drawsBefore;
+    programState->batchedDraws = roomModel.batchStats.drawsAfter + horseModel.batchStats.drawsAfter;
+
+    programState->pointLights.resize(3);
+    PointLight& pointLight1 = programState->pointLights[0];
     pointLight1.position = glm::vec3(5.6f, 8.7f, 26.5f);
     pointLight1.ambient = glm::vec3(0.2, 0.2, 0.2);
     pointLight1.diffuse = glm::vec3(6.0, 6.0, 6.0);
@@ -200,7 +361,7 @@ int main() {
     pointLight1.linear = 0.09f;
     pointLight1.quadratic = 0.0036f;
 
-    PointLight& pointLight2 = programState->pointLight2;
+    PointLight& pointLight2 = programState->pointLights[1];
     pointLight2.position = glm::vec3(20.0f, 8.7f, 26.5f);
     pointLight2.ambient = glm::vec3(0.0, 0.0, 0.2);
     pointLight2.diffuse = glm::vec3(0.0, 0.0, 6.0);
@@ -210,7 +371,7 @@ int main() {
     pointLight2.linear = 0.09f;
     pointLight2.quadratic = 0.0036f;
 
-    PointLight& pointLight3 = programState->pointLight3;
+    PointLight& pointLight3 = programState->pointLights[2];
     pointLight3.position = glm::vec3(-37.0f, 4.0f, -35.0f);
     pointLight3.ambient = glm::vec3(0.2, 0.2, 0.2);
     pointLight3.diffuse = glm::vec3(6.0, 6.0, 6.0);
@@ -220,6 +381,13 @@ int main() {
     pointLight3.linear = 0.09f;
     pointLight3.quadratic = 0.0036f;
 
+    // world space bounds of the room, the benchmark lights are spawned inside it
+    glm::vec3 roomMin, roomMax;
+    roomModel.Bounds(roomMin, roomMax);
+    roomMin = programState->roomPosition + roomMin * programState->roomScale;
+    roomMax = programState->roomPosition + roomMax * programState->roomScale;
+    std::vector<PointLight> benchmarkLights;
+
     float quadVertices[] = {
             -1.0f,  1.0f, 0.0f,   0.0f, 1.0f,
             -1.0f, -1.0f, 0.0f,   0.0f, 0.0f,
@@ -270,10 +438,17 @@ int main() {
     blendingShader.use();
     blendingShader.setInt("texture1", 0);
 
-    screenShader.use();
-
-    screenShader.setInt("screenTexture", 0);
-    screenShader.setBool("grayscaleEnabled", programState->grayscaleEnabled);
+    // every scene draw goes through the queue: opaque models front to back, then the light beams back to front
+    rg::RenderQueue renderQueue;
+    renderQueue.SetPass(PASS_OPAQUE, [] { rg::GLCache().Enable(GL_CULL_FACE); });
+    renderQueue.SetPass(PASS_TRANSPARENT, [] { rg::GLCache().Disable(GL_CULL_FACE); }, true);
+    const unsigned int modelShaderId = renderQueue.RegisterShader(ourShader);
+    const unsigned int blendingShaderId = renderQueue.RegisterShader(blendingShader);
+    const unsigned int roomMaterial = registerModelMaterial(renderQueue, roomModel, ourShader);
+    const unsigned int horseMaterial = registerModelMaterial(renderQueue, horseModel, ourShader);
+    const unsigned int beamMaterial = renderQueue.RegisterMaterial([transparentTexture] {
+        rg::GLCache().BindTexture(0, GL_TEXTURE_2D, transparentTexture);
+    });
 
     //hdr
     unsigned int hdrFBO;
@@ -325,198 +500,239 @@ int main() {
     }
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
-    //framebuffer
-    unsigned int fbo;
-    glGenFramebuffers(1, &fbo);
-    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
-
-    unsigned int textureColorbuffer;
-    glGenTextures(1, &textureColorbuffer);
-    glBindTexture(GL_TEXTURE_2D, textureColorbuffer);
-
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, SCR_WIDTH, SCR_HEIGHT, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
-
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, textureColorbuffer, 0);
-
-    if(glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE){
-        std::cout << "Framebuffer works!";
-    }
-
-    //glBindFramebuffer(GL_FRAMEBUFFER, 0);
-
-    hdrShader.use();
-    hdrShader.setInt("scene", 0);
-    hdrShader.setInt("bloomBlur", 1);
+    // bloom composite, tone mapping, gamma and grayscale in a single pass
+    rg::PostStack postStack;
+    postStack.Init("resources/shaders/hdr.vs", "resources/shaders/post.fs");
 
     blurShader.use();
     blurShader.setInt("image", 0);
 
+    rg::DualFilterBloom dualFilterBloom;
+    dualFilterBloom.Init(SCR_WIDTH, SCR_HEIGHT, 5);
+    const char* bloomStageNames[2] = {"bloom (gaussian)", "bloom (dual filter)"};
+
+    // final image target: the default framebuffer, or an offscreen one in benchmark mode
+    unsigned int outputFBO = 0;
+    rg::CameraPath cameraPath = rg::CameraPath::Default();
+    unsigned int benchmarkFrame = 0;
+    if (benchmark.enabled) {
+        if (!benchmark.cameraPath.empty() && !cameraPath.LoadFromFile(benchmark.cameraPath)) {
+            glfwTerminate();
+            return -1;
+        }
+        unsigned int outputColorbuffer;
+        glGenTextures(1, &outputColorbuffer);
+        glBindTexture(GL_TEXTURE_2D, outputColorbuffer);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, SCR_WIDTH, SCR_HEIGHT, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+        glGenFramebuffers(1, &outputFBO);
+        glBindFramebuffer(GL_FRAMEBUFFER, outputFBO);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, outputColorbuffer, 0);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            std::cout << "ERROR::BENCHMARK::FRAMEBUFFER_INCOMPLETE" << std::endl;
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glfwSwapInterval(0);
+        // every frame gets its GPU times, at the cost of waiting on the queries
+        profiler.waitForResults = true;
+        std::cout << "Benchmark: " << benchmark.warmupFrames << " warmup + " << benchmark.frames << " frames, "
+                  << benchmark.timestep << " s timestep, " << SCR_WIDTH << "x" << SCR_HEIGHT << ", "
+                  << rg::VertexFormatName(benchmark.vertexFormat) << " vertices" << std::endl;
+    }
+
     // draw in wireframe
     //glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
 
     // render loop
     // -----------
-    while (!glfwWindowShouldClose(window)) {
-        // per-frame time logic
-        // --------------------
-        float currentFrame = glfwGetTime();
-        deltaTime = currentFrame - lastFrame;
-        lastFrame = currentFrame;
-
-        // input
-        // -----
-        processInput(window);
+    while (benchmark.enabled ? benchmarkFrame < benchmark.warmupFrames + benchmark.frames : !glfwWindowShouldClose(window)) {
+        if (benchmark.enabled) {
+            // fixed timestep, the camera follows the scripted path instead of the input
+            deltaTime = benchmark.timestep;
+            glm::vec3 cameraPosition, cameraTarget;
+            cameraPath.Evaluate(benchmarkFrame * benchmark.timestep, cameraPosition, cameraTarget);
+            float yaw, pitch;
+            rg::LookAtAngles(cameraPosition, cameraTarget, yaw, pitch);
+            programState->camera = Camera(cameraPosition, glm::vec3(0.0f, 1.0f, 0.0f), yaw, pitch);
+            if (benchmarkFrame == benchmark.warmupFrames)
+                profiler.RecordFrames(true);
+        } else {
+            // per-frame time logic
+            // --------------------
+            float currentFrame = glfwGetTime();
+            deltaTime = currentFrame - lastFrame;
+            lastFrame = currentFrame;
+
+            // input
+            // -----
+            processInput(window);
+        }
+        profiler.BeginFrame();
+        // loading, resizing and last frame's ImGui may have bound things behind the cache's back
+        rg::GLCache().Invalidate();
 
 
         //glBindFramebuffer(GL_FRAMEBUFFER, fbo);
-        glEnable(GL_DEPTH_TEST);
+        rg::GLCache().Enable(GL_DEPTH_TEST);
 
         // render
         // ------
         glClearColor(programState->clearColor.r, programState->clearColor.g, programState->clearColor.b, 1.0f);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
 
-        glBindFramebuffer(GL_FRAMEBUFFER, hdrFBO);
+        rg::GLCache().BindFramebuffer(GL_FRAMEBUFFER, hdrFBO);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-        // don't forget to enable shader before setting uniforms
-
-        ourShader.use();
-        ourShader.setVec3("pointLight1.position", pointLight1.position);
-        ourShader.setVec3("pointLight1.ambient", pointLight1.ambient);
-        ourShader.setVec3("pointLight1.diffuse", pointLight1.diffuse);
-        ourShader.setVec3("pointLight1.specular", pointLight1.specular);
-        ourShader.setFloat("pointLight1.constant", pointLight1.constant);
-        ourShader.setFloat("pointLight1.linear", pointLight1.linear);
-        ourShader.setFloat("pointLight1.quadratic", pointLight1.quadratic);
-
-        ourShader.setVec3("pointLight2.position", pointLight2.position);
-        ourShader.setVec3("pointLight2.ambient", pointLight2.ambient);
-        ourShader.setVec3("pointLight2.diffuse", pointLight2.diffuse);
-        ourShader.setVec3("pointLight2.specular", pointLight2.specular);
-        ourShader.setFloat("pointLight2.constant", pointLight2.constant);
-        ourShader.setFloat("pointLight2.linear", pointLight2.linear);
-        ourShader.setFloat("pointLight2.quadratic", pointLight2.quadratic);
-
-        ourShader.setVec3("pointLight3.position", pointLight3.position);
-        ourShader.setVec3("pointLight3.ambient", pointLight3.ambient);
-        ourShader.setVec3("pointLight3.diffuse", pointLight3.diffuse);
-        ourShader.setVec3("pointLight3.specular", pointLight3.specular);
-        ourShader.setFloat("pointLight3.constant", pointLight3.constant);
-        ourShader.setFloat("pointLight3.linear", pointLight3.linear);
-        ourShader.setFloat("pointLight3.quadratic", pointLight3.quadratic);
-
-        ourShader.setVec3("viewPosition", programState->camera.Position);
-        ourShader.setFloat("material.shininess", 32.0f);
-
-        // view/projection transformations
+        // view/projection transformations and lights, uploaded once for all programs
         glm::mat4 projection = glm::perspective(glm::radians(programState->camera.Zoom),
-                                                (float) SCR_WIDTH / (float) SCR_HEIGHT, 0.1f, 100.0f);
+                                                (float) SCR_WIDTH / (float) SCR_HEIGHT, 0.1f, FAR_PLANE);
         glm::mat4 view = programState->camera.GetViewMatrix();
-        ourShader.setMat4("projection", projection);
-        ourShader.setMat4("view", view);
+        frameUniforms.camera.projection = projection;
+        frameUniforms.camera.view = view;
+        frameUniforms.camera.viewPosition = glm::vec4(programState->camera.Position, 1.0f);
+
+        profiler.Begin("lights");
+        if ((int)benchmarkLights.size() != programState->benchmarkLightCount)
+            spawnBenchmarkLights(benchmarkLights, programState->benchmarkLightCount, roomMin, roomMax);
+        gpuLights.clear();
+        for (const PointLight& light : programState->pointLights)
+            gpuLights.push_back(toGpuLight(light));
+        for (const PointLight& light : benchmarkLights)
+            gpuLights.push_back(toGpuLight(light));
+        lightClusters.Update(gpuLights, view, glm::radians(programState->camera.Zoom),
+                             (float) SCR_WIDTH / (float) SCR_HEIGHT, 0.1f, FAR_PLANE, SCR_WIDTH, SCR_HEIGHT);
+        lightClusters.Bind();
+        programState->lightStats = lightClusters.stats;
+        frameUniforms.lights.clusterDims = glm::uvec4(rg::CLUSTERS_X, rg::CLUSTERS_Y, rg::CLUSTERS_Z, gpuLights.size());
+        frameUniforms.lights.clusterParams = lightClusters.Params();
+        frameUniforms.Upload();
+        profiler.End();
+
+        profiler.Begin("scene");
+        renderQueue.Clear();
+        rg::CullStats cullStats;
+        rg::IndirectDrawStats drawStats;
+        const glm::vec3 cameraPosition = programState->camera.Position;
 
         // render the loaded model
         glm::mat4 model = glm::mat4(1.0f);
         model = glm::translate(model,
                                programState->roomPosition); // translate it down so it's at the center of the scene
         model = glm::scale(model, glm::vec3(programState->roomScale));
-        ourShader.setMat4("model", model);
-        roomModel.Draw(ourShader);
+        glm::mat4 roomMvp = projection * view * model;
+        renderQueue.Submit(PASS_OPAQUE, modelShaderId, roomMaterial, roomModel.VAO(),
+                           glm::distance(programState->roomPosition, cameraPosition) / FAR_PLANE, model,
+                           [&, roomMvp] { drawModel(roomModel, roomMvp, cullStats, drawStats); });
 
         model = glm::mat4(1.0f);
         model = glm::translate(model, programState->horsePosition);
         model = glm::scale(model, glm::vec3(programState->horseScale));
-        ourShader.setMat4("model", model);
-        horseModel.Draw(ourShader);
-
-        glDisable(GL_CULL_FACE);
-        blendingShader.use();
-        blendingShader.setMat4("projection", projection);
-        blendingShader.setMat4("view", view);
-
-        std::sort(lights.begin(), lights.end(), [cameraPosition = programState->camera.Position](const glm::vec3& a, const glm::vec3& b) {
-            float d1 = glm::distance(a, cameraPosition);
-            float d2 = glm::distance(b, cameraPosition);
-            return d1 > d2;
-        });
-
-        glBindVertexArray(transparentVAO);
-        glBindTexture(GL_TEXTURE_2D, transparentTexture);
-        for(int i = 0; i < lights.size(); i++){
+        glm::mat4 horseMvp = projection * view * model;
+        renderQueue.Submit(PASS_OPAQUE, modelShaderId, horseMaterial, horseModel.VAO(),
+                           glm::distance(programState->horsePosition, cameraPosition) / FAR_PLANE, model,
+                           [&, horseMvp] { drawModel(horseModel, horseMvp, cullStats, drawStats); });
+
+        for (const glm::vec3& light : lights) {
             model = glm::mat4(1.0f);
-            model = glm::translate(model, lights[i]);
+            model = glm::translate(model, light);
             model = glm::rotate(model, glm::radians(90.0f), glm::vec3(0.0f, 1.0f, 0.0f));
             model = glm::scale(model, glm::vec3(10.0f));
-            blendingShader.setMat4("model", model);
-            glDrawArrays(GL_TRIANGLES, 0, 6);
+            renderQueue.Submit(PASS_TRANSPARENT, blendingShaderId, beamMaterial, transparentVAO,
+                               glm::distance(light, cameraPosition) / FAR_PLANE, model,
+                               [] { glDrawArrays(GL_TRIANGLES, 0, 6); });
         }
 
-        glEnable(GL_CULL_FACE);
+        renderQueue.Execute();
+        rg::GLCache().Enable(GL_CULL_FACE);
+        programState->cullStats = cullStats;
+        programState->drawStats = drawStats;
+        programState->queueStats = renderQueue.Stats();
+        profiler.End();
 
-        if (programState->ImGuiEnabled)
+        if (programState->ImGuiEnabled) {
+            profiler.Begin("imgui");
             DrawImGui(programState);
+            // the ImGui backend binds its own program, VAO, texture and blend state
+            rg::GLCache().Invalidate();
+            profiler.End();
+        }
 
-        glDisable(GL_DEPTH_TEST);
-
-        glBindFramebuffer(GL_FRAMEBUFFER, 0);
-
-        bool horizontal = true;
-        bool firstIteration = true;
-        blurShader.use();
-        unsigned int amount = 10;
-        for(unsigned int i = 0; i < amount; i++){
-            glBindFramebuffer(GL_FRAMEBUFFER, pingpongFBO[horizontal]);
-            blurShader.setBool("horizontal", horizontal);
-            glActiveTexture(GL_TEXTURE0);
-            glBindTexture(GL_TEXTURE_2D, firstIteration ? hdrColorBuffers[i] : pingpongColorBuffers[!horizontal]);
-
-            glBindVertexArray(quadVAO);
-            glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
-            glBindVertexArray(0);
-
-            horizontal = !horizontal;
-            if(firstIteration){
-                firstIteration = false;
+        rg::GLCache().Disable(GL_DEPTH_TEST);
+
+        rg::GLCache().BindFramebuffer(GL_FRAMEBUFFER, 0);
+
+        // bloom is skipped altogether when it is not composited
+        unsigned int bloomTexture = 0;
+        if (programState->bloom) {
+            profiler.Begin(bloomStageNames[programState->dualFilterBloom]);
+            if (programState->dualFilterBloom) {
+                // progressive downsample/upsample at half resolution and below
+                bloomTexture = dualFilterBloom.Render(hdrColorBuffers[0], SCR_WIDTH, SCR_HEIGHT, quadVAO, SCR_WIDTH, SCR_HEIGHT);
+            } else {
+                bool horizontal = true;
+                bool firstIteration = true;
+                blurShader.use();
+                rg::GLCache().BindVertexArray(quadVAO);
+                unsigned int amount = 10;
+                for(unsigned int i = 0; i < amount; i++){
+                    rg::GLCache().BindFramebuffer(GL_FRAMEBUFFER, pingpongFBO[horizontal]);
+                    blurShader.setBool("horizontal"_uniform, horizontal);
+                    rg::GLCache().BindTexture(0, GL_TEXTURE_2D, firstIteration ? hdrColorBuffers[i] : pingpongColorBuffers[!horizontal]);
+                    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+
+                    horizontal = !horizontal;
+                    if(firstIteration){
+                        firstIteration = false;
+                    }
+                }
+                bloomTexture = pingpongColorBuffers[!horizontal];
             }
+            profiler.End();
         }
+        programState->bloomMs[0] = profiler.GpuMs(bloomStageNames[0]);
+        programState->bloomMs[1] = profiler.GpuMs(bloomStageNames[1]);
 
-        glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+        profiler.Begin("post");
+        rg::GLCache().BindFramebuffer(GL_FRAMEBUFFER, outputFBO);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-        hdrShader.use();
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, hdrColorBuffers[0]);
-        glActiveTexture(GL_TEXTURE1);
-        glBindTexture(GL_TEXTURE_2D, pingpongColorBuffers[!horizontal]);
-        hdrShader.setInt("hdr", programState->hdr);
-        hdrShader.setInt("bloom", programState->bloom);
-        hdrShader.setFloat("exposure", programState->exposure);
-        glBindVertexArray(quadVAO);
-        glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
-        glBindVertexArray(0);
-
-        glBindFramebuffer(GL_FRAMEBUFFER, 0);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-        screenShader.use();
-        screenShader.setInt("grayscaleEnabled", programState->grayscaleEnabled);
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, textureColorbuffer);
-
-        glBindVertexArray(quadVAO);
-        glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
-        glBindVertexArray(0);
-
-        glEnable(GL_DEPTH_TEST);
+        unsigned int postEffects = (programState->bloom ? rg::POST_BLOOM : 0) | (programState->hdr ? rg::POST_TONEMAP : 0)
+                                   | (programState->gamma ? rg::POST_GAMMA : 0)
+                                   | (programState->grayscaleEnabled ? rg::POST_GRAYSCALE : 0);
+        rg::PostInputs postInputs;
+        postInputs.scene = hdrColorBuffers[0];
+        postInputs.bloom = bloomTexture;
+        postInputs.exposure = programState->exposure;
+        postStack.Render(postEffects, postInputs, quadVAO);
+        profiler.End();
+
+        rg::GLCache().Enable(GL_DEPTH_TEST);
+        profiler.EndFrame();
+        programState->glStats = rg::GLCache().TakeStats();
+
+        if (benchmark.enabled) {
+            unsigned int measuredFrame = benchmarkFrame - std::min(benchmarkFrame, benchmark.warmupFrames);
+            if (benchmark.captureEvery > 0 && benchmarkFrame >= benchmark.warmupFrames
+                && measuredFrame % benchmark.captureEvery == 0) {
+                std::ostringstream filename;
+                filename << benchmark.capturePrefix << std::setw(5) << std::setfill('0') << measuredFrame << ".ppm";
+                rg::GLCache().BindFramebuffer(GL_READ_FRAMEBUFFER, outputFBO);
+                rg::CaptureFramebuffer(filename.str(), SCR_WIDTH, SCR_HEIGHT);
+                rg::GLCache().BindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+            }
+            benchmarkFrame++;
+            glfwPollEvents();
+            continue;
+        }
         // glfw: swap buffers and poll IO events (keys pressed/released, mouse moved etc.)
         // -------------------------------------------------------------------------------
         glfwSwapBuffers(window);
         glfwPollEvents();
     }
 
-    programState->SaveToFile("resources/program_state.txt");
+    if (benchmark.enabled) {
+        profiler.Flush();
+        rg::WriteBenchmarkReport(profiler, benchmark.csvPath);
+    } else {
+        programState->SaveToFile("resources/program_state.txt");
+    }
     delete programState;
     ImGui_ImplOpenGL3_Shutdown();
     ImGui_ImplGlfw_Shutdown();
@@ -595,7 +811,30 @@ void DrawImGui(ProgramState *programState) {
         ImGui::Text("Press 'F' for grayscale mode");
         ImGui::Text("Press 'H' for hdr");
         ImGui::Text("Press 'B' for bloom");
+        ImGui::Text("Press 'M' to switch the bloom filter");
+        ImGui::Checkbox("Dual filter bloom", &programState->dualFilterBloom);
+        ImGui::Text("Bloom GPU time: gaussian %.3f ms, dual filter %.3f ms", programState->bloomMs[0], programState->bloomMs[1]);
         ImGui::DragFloat("HDR exposure", &programState->exposure, 0.05, 0.1, 5.0);
+        ImGui::Checkbox("Gamma correction", &programState->gamma);
+        ImGui::Checkbox("Frustum culling", &programState->frustumCulling);
+        ImGui::Text("Objects drawn: %u, culled: %u", programState->cullStats.drawn, programState->cullStats.culled);
+        ImGui::Checkbox("Multi draw indirect", &programState->multiDrawIndirect);
+        if (!rg::MultiDrawIndirectSupported()) {
+            ImGui::SameLine();
+            ImGui::Text("(not supported, one draw per mesh)");
+        }
+        ImGui::Text("Draw calls: %u for %u index ranges", programState->drawStats.drawCalls, programState->drawStats.commands);
+        if (programState->staticBatching)
+            ImGui::Text("Static batching: %u -> %u draws unculled", programState->unbatchedDraws, programState->batchedDraws);
+        else
+            ImGui::Text("Static batching: off (--static-batching), %u draws unculled", programState->unbatchedDraws);
+        ImGui::Text("Queue: %u draws, %u program / %u material / %u VAO switches", programState->queueStats.draws,
+                    programState->queueStats.programSwitches, programState->queueStats.materialSwitches,
+                    programState->queueStats.vaoSwitches);
+        ImGui::Text("GL state calls: %u issued, %u skipped", programState->glStats.issued, programState->glStats.skipped);
+        ImGui::Text("Vertex buffers: %.2f MB (%s)", programState->vertexBufferBytes / (1024.0 * 1024.0),
+                    rg::VertexFormatName(programState->vertexFormat));
+        ImGui::Text("Index buffers: %.2f MB", programState->indexBufferBytes / (1024.0 * 1024.0));
         ImGui::ColorEdit3("Background color", (float *) &programState->clearColor);
         ImGui::DragFloat3("Room position", (float*)&programState->roomPosition);
         ImGui::DragFloat("Room scale", &programState->roomScale, 0.05, 0.1, 4.0);
@@ -615,10 +854,40 @@ void DrawImGui(ProgramState *programState) {
         ImGui::End();
     }
 
+    {
+        ImGui::Begin("Lights");
+        const rg::LightClusterStats& stats = programState->lightStats;
+        ImGui::SliderInt("Benchmark lights", &programState->benchmarkLightCount, 0, 1024);
+        ImGui::Text("Lights: %u (%u in view)", stats.lightCount, stats.visibleLights);
+        ImGui::Text("Clusters: %ux%ux%u", rg::CLUSTERS_X, rg::CLUSTERS_Y, rg::CLUSTERS_Z);
+        ImGui::Text("Light/cluster pairs: %u, max per cluster: %u", stats.lightClusterPairs, stats.maxLightsPerCluster);
+        ImGui::Text("CPU assignment: %.3f ms", stats.assignMs);
+        ImGui::End();
+    }
+
+    DrawProfilerWindow(profiler);
+
     ImGui::Render();
     ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
 }
 
+void DrawProfilerWindow(rg::Profiler &profiler) {
+    ImGui::Begin("Profiler");
+    ImGui::Text("Frame (CPU): %.3f ms", profiler.FrameAverageMs());
+    for (const rg::Profiler::Stage& stage : profiler.Stages()) {
+        ImGui::Text("%s: CPU %.3f ms, GPU %.3f ms", stage.name.c_str(), stage.cpuAverageMs, stage.gpuAverageMs);
+        // oldest sample first, the graph scrolls as frames come in
+        std::string label = "##" + stage.name;
+        ImGui::PlotLines(label.c_str(), stage.gpuHistory.data(), rg::Profiler::HISTORY, (stage.historyPos + 1) % rg::Profiler::HISTORY,
+                         "GPU ms", 0.0f, FLT_MAX, ImVec2(0, 40));
+    }
+    if (ImGui::Button("Export Chrome trace")) {
+        if (profiler.ExportChromeTrace("profile_trace.json"))
+            std::cout << "Profiler trace written to profile_trace.json" << std::endl;
+    }
+    ImGui::End();
+}
+
 void key_callback(GLFWwindow *window, int key, int scancode, int action, int mods) {
     if (key == GLFW_KEY_F1 && action == GLFW_PRESS) {
         programState->ImGuiEnabled = !programState->ImGuiEnabled;
@@ -646,6 +915,10 @@ void key_callback(GLFWwindow *window, int key, int scancode, int action, int mod
                 programState->hdr = true;
     }
 
+    if(key == GLFW_KEY_M && action == GLFW_PRESS){
+        programState->dualFilterBloom = !programState->dualFilterBloom;
+    }
+
     if(key == GLFW_KEY_B && action == GLFW_PRESS){
         if(glfwGetKey(window, GLFW_KEY_B) == GLFW_PRESS)
             if(programState->bloom)
@@ -672,9 +945,20 @@ unsigned int loadTexture(char const* path){
         else if(nrComponents == 4)
             format = GL_RGBA;
 
+        // the sprite is blended: keep its mips from fading out as they get smaller
+        rg::MipOptions mipOptions;
+        mipOptions.srgb = true;
+        mipOptions.preserveAlphaCoverage = nrComponents == 4;
+        std::vector<rg::MipLevel> mips = rg::GenerateMips(data, width, height, nrComponents, mipOptions);
+
         glBindTexture(GL_TEXTURE_2D, textureID);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
         glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0 ,format, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
+        for (size_t level = 0; level < mips.size(); level++)
+            glTexImage2D(GL_TEXTURE_2D, (GLint)level + 1, format, mips[level].width, mips[level].height, 0, format,
+                         GL_UNSIGNED_BYTE, mips[level].pixels.data());
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint)mips.size());
 
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, format == GL_RGBA ? GL_CLAMP_TO_EDGE : GL_REPEAT);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, format == GL_RGBA ? GL_CLAMP_TO_EDGE : GL_REPEAT);
@@ -690,4 +974,27 @@ unsigned int loadTexture(char const* path){
     stbi_set_flip_vertically_on_load(false);
 
     return textureID;
-}
\ No newline at end of file
+}
+
+// --mip-benchmark: scalar against SIMD mip generation on the scene's textures, as color (sRGB) and as data
+void runMipBenchmark() {
+    const char* paths[] = {"resources/textures/light.png", "resources/objects/horsie/texture_diffuse1.png",
+                           "resources/objects/horsie/texture_bump1.png", "resources/objects/blacklodge/texture_diffuse1.png"};
+    const unsigned int repetitions = 5;
+    for (const char* path : paths) {
+        int width, height, components;
+        unsigned char* data = stbi_load(FileSystem::getPath(path).c_str(), &width, &height, &components, 0);
+        if (!data) {
+            std::cout << "Texture failed to load at path: " << path << std::endl;
+            continue;
+        }
+        for (int srgb = 0; srgb < 2; srgb++) {
+            rg::MipBenchmarkResult result = rg::BenchmarkMips(data, width, height, components, repetitions, srgb == 1);
+            std::cout << path << " (" << width << "x" << height << "x" << components << (srgb ? ", sRGB" : ", linear")
+                      << "): scalar " << result.scalarMs << " ms, SIMD " << result.simdMs << " ms, "
+                      << result.scalarMs / std::max(result.simdMs, 1e-6) << "x, " << result.mismatchedBytes
+                      << " bytes differ" << std::endl;
+        }
+        stbi_image_free(data);
+    }
+}